@@ -7,16 +7,20 @@
 
 #include "minigb_apu.h"
 
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __ARM_FEATURE_SIMD32
+#include <arm_acle.h>
+#endif
+
 #include "../src/game_scene.h"
 #include "app.h"
 #include "dtcm.h"
 
 #define DMG_CLOCK_FREQ_U ((unsigned)DMG_CLOCK_FREQ)
-#define AUDIO_NSAMPLES (AUDIO_SAMPLES * 2u)
 
 #define AUDIO_MEM_SIZE (0xFF40 - 0xFF10)
 #define AUDIO_ADDR_COMPENSATION 0xFF10
@@ -29,17 +33,49 @@
 #define MIN(a, b) (a <= b ? a : b)
 #endif
 
-#define VOL_INIT_MAX (INT16_MAX / 8)
-#define VOL_INIT_MIN (INT16_MIN / 8)
+/* Output of a square or noise channel per step of its volume; a channel
+ * at full volume spans +/-15 * CHAN_LEVEL, leaving int16 headroom for the
+ * overshoot of band-limited steps. A wave sample step is scaled so that a
+ * full-range wave matches a full-volume square. */
+#define CHAN_LEVEL 1024
+#define WAVE_LEVEL (CHAN_LEVEL * MAX_CHAN_VOLUME / 8)
+
+/* Synthesis rate, AUDIO_OUTPUT_RATE >> replication_shift: each synthesised
+ * sample covers replication output samples. */
+static uint32_t sample_rate = AUDIO_OUTPUT_RATE / 2;
+static uint8_t replication_shift = 1;
+static uint8_t replication = 2;
+static volatile uint8_t replication_shift_requested = 1;
+#define REPLICATION_SHIFT_MAX 2
+
+/* Last synthesised sample, for upsample. */
+static int16_t upsample_prev_l, upsample_prev_r;
 
 /* Handles time keeping for sound generation.
- * FREQ_INC_REF must be equal to, or larger than AUDIO_SAMPLE_RATE in order
- * to avoid a division by zero error.
- * Using a square of 2 simplifies calculations. */
-#define FREQ_INC_REF (AUDIO_SAMPLE_RATE * 1)
+ * Counters advance by a rate in Hz each sample and are due when they pass
+ * FREQ_INC_REF, which is therefore the synthesis rate. */
+#define FREQ_INC_REF sample_rate
 
 #define MAX_CHAN_VOLUME 15
 
+// a multiple of every replication
+#define MAX_CHUNK 256
+
+/* Each channel renders a chunk, one sample per synthesised sample, into
+ * its own lane of mix_buf; mix() then pans, scales and sums the lanes into
+ * the output. A sample's four lanes are adjacent so that two channels load
+ * as one word for SMLAD. */
+static int16_t mix_buf[MAX_CHUNK][4];
+
+/* Mix gain per step of NR50 volume at unity master gain, with MIX_SHIFT
+ * fractional bits: four channels at full volume, with NR50 at 7, just
+ * reach full scale. Louder mixes saturate. */
+#define MIX_SHIFT 14
+#define MIX_GAIN_PER_VOL \
+    ((INT16_MAX << MIX_SHIFT) / (4 * MAX_CHAN_VOLUME * CHAN_LEVEL * 7))
+
+static volatile uint16_t master_gain = AUDIO_GAIN_UNITY;
+
 #ifdef TARGET_SIMULATOR
 #define __audio
 #else
@@ -49,11 +85,92 @@
 #endif
 
 /**
- * Memory holding audio registers between 0xFF10 and 0xFF3F inclusive.
+ * Memory holding audio registers between 0xFF10 and 0xFF3F inclusive, as
+ * the game sees them.
  */
 static uint8_t *audio_mem = NULL;
+
+/**
+ * The same registers as the channels see them: audio_mem as of the last
+ * register write replayed by audio_callback.
+ */
+static uint8_t regs[AUDIO_MEM_SIZE];
+
 static uint32_t precomputed_noise_freqs[8][16];
 
+/* Wave RAM decoded to output levels, one table of its 32 samples for each NR32
+ * volume setting, updated by apu_write whenever wave RAM is written. */
+static int16_t wave_table[4][32];
+
+/* The noise channel's output sequences, one bit per LFSR step from a
+ * trigger, packed from the low bit of each word up: the 7-bit LFSR repeats
+ * every 127 steps and the 15-bit LFSR every 32767, so the channel keeps
+ * only its position in the sequence and can take any number of steps at
+ * once. */
+#define LFSR7_PERIOD 127
+#define LFSR15_PERIOD 32767
+static uint32_t lfsr7_bits[(LFSR7_PERIOD + 31) / 32];
+static uint32_t lfsr15_bits[(LFSR15_PERIOD + 31) / 32];
+
+/* Register writes are queued with the emulated time they were made at, and
+ * replayed by audio_callback at the matching sample, so that every write
+ * in a frame is heard rather than only the state at callback time.
+ *
+ * The queue is the only state the two threads share besides emu_time,
+ * apu_time and chan_status: audio_write only produces into it and
+ * audio_callback only consumes, each index being written by one side alone
+ * and published with release/acquire ordering, so neither side blocks or
+ * sees a half-written event. The channels and regs belong to the audio
+ * thread, or to the caller of audio_suspend until audio_resume. */
+#define AUDIO_QUEUE_SIZE 512 /* power of 2 */
+
+struct audio_event
+{
+    uint32_t time; /* in cycles, see audio_end_frame() */
+    uint8_t reg;   /* address - AUDIO_ADDR_COMPENSATION */
+    uint8_t val;
+};
+
+static struct audio_event queue[AUDIO_QUEUE_SIZE];
+static uint32_t queue_head; /* next to write, by audio_write */
+static uint32_t queue_tail; /* next to replay, by audio_callback */
+
+#define QUEUE_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define QUEUE_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/* Emulated time at which the current frame started. */
+static uint32_t emu_time;
+
+/* NR52 channel status bits, kept by the audio thread; audio_read merges
+ * them with the power bit in audio_mem. */
+static volatile uint8_t chan_status;
+
+/* Written by one side each: overruns by audio_write, the rest by
+ * audio_callback. */
+static volatile struct audio_stats stats;
+
+/* Emulated time of the next sample audio_callback synthesises, and how far
+ * behind emu_time it is kept: a frame's writes are all queued before the
+ * frame is played. Written only by audio_callback, and read by
+ * audio_get_stats for the fill level. */
+static uint32_t apu_time;
+static uint32_t apu_starved_at; /* emu_time when apu_time last passed it */
+#define AUDIO_LATENCY_CYCLES ((uint32_t)SCREEN_REFRESH_CYCLES)
+
+/* Cycles per output sample, in 16.16 fixed point. */
+#define AUDIO_CYCLES_PER_SAMPLE \
+    ((uint32_t)(DMG_CLOCK_FREQ * 65536 / AUDIO_OUTPUT_RATE))
+
+/* apu_time follows emu_time gently, as emulation does not run at exactly
+ * the Game Boy's rate; it jumps if emulation gets further ahead than this,
+ * or if it would otherwise overtake emu_time. */
+#define AUDIO_CLOCK_GAIN_SHIFT 6
+#define AUDIO_RESYNC_CYCLES (4 * (uint32_t)SCREEN_REFRESH_CYCLES)
+
+/* Set when emulation is paced to keep the fill level instead, so that
+ * apu_time advances at the nominal rate apart from the jumps above. */
+static volatile bool clock_paced;
+
 struct chan_len_ctr
 {
     uint8_t load;
@@ -97,6 +214,9 @@ struct chan
 
     int_fast16_t val;
 
+    /* Output level last passed to blep_level. */
+    int32_t blep_out;
+
     struct chan_len_ctr len;
     struct chan_vol_env env;
     struct chan_freq_sweep sweep;
@@ -110,14 +230,10 @@ struct chan
         } square;
         struct
         {
-            uint16_t lfsr_reg;
+            uint16_t lfsr_pos; /* next step, in the selected sequence */
             uint8_t lfsr_wide;
             uint8_t lfsr_div;
         } noise;
-        struct
-        {
-            uint8_t sample;
-        } wave;
     };
 };
 
@@ -125,24 +241,39 @@ struct chan chans[4];
 
 static int32_t vol_l, vol_r;
 
+/* Band-limited synthesis of the square and noise channels: each change in
+ * a channel's output level is added to its delta buffer as a band-limited
+ * impulse, looked up from a kernel by its sub-sample time, and the buffer
+ * is integrated into its lane of mix_buf. A channel costs BLEP_WIDTH
+ * multiplies per level change rather than work per sample; at most one
+ * change per sample is kept, which bounds the cost of noise and very high
+ * notes. */
+#define BLEP_WIDTH 8
+#define BLEP_PHASE_BITS 5
+#define BLEP_PHASES (1 << BLEP_PHASE_BITS)
+#define BLEP_SHIFT 14 /* each kernel phase sums to 1 << BLEP_SHIFT */
+#define BLEP_CUTOFF 0.42f /* of the synthesis rate */
+#define BLEP_BUF_SIZE (MAX_CHUNK + BLEP_WIDTH)
+
+static int16_t blep_kernel[BLEP_PHASES][BLEP_WIDTH];
+/* Per channel; the wave channel's are unused. */
+static int32_t blep_buf[4][BLEP_BUF_SIZE];
+static int32_t blep_acc[4];
+
+static volatile enum audio_quality quality_requested = AUDIO_QUALITY_FAST;
+static enum audio_quality quality = AUDIO_QUALITY_FAST;
+
 __audio static void set_note_freq(struct chan *c, const uint32_t freq)
 {
     /* Lowest expected value of freq is 64. */
-    c->freq_inc = freq * (uint32_t)(FREQ_INC_REF / AUDIO_SAMPLE_RATE);
+    c->freq_inc = freq;
 }
 
 static void chan_enable(const uint_fast8_t i, const bool enable)
 {
-    uint8_t val;
-
     chans[i].enabled = enable;
-    val = (audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] & 0x80) |
-          (chans[3].enabled << 3) | (chans[2].enabled << 2) |
-          (chans[1].enabled << 1) | (chans[0].enabled << 0);
-
-    audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] = val;
-    // audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] |= 0x80 | ((uint8_t)enable)
-    // << i;
+    chan_status = (chans[3].enabled << 3) | (chans[2].enabled << 2) |
+                  (chans[1].enabled << 1) | (chans[0].enabled << 0);
 }
 
 __audio static void update_env(struct chan *c)
@@ -237,21 +368,96 @@ __audio static void update_sweep(struct chan *c)
     }
 }
 
-__audio static void update_square(int16_t *left, int16_t *right, const bool ch2,
-                                  int len)
+/* Samples until a counter advancing by inc each sample next exceeds
+ * FREQ_INC_REF, as in update_env and update_sweep; at most max. */
+__audio static inline int steps_to_ref(const uint32_t counter,
+                                       const uint32_t inc, const int max)
 {
-    struct chan *c = chans + ch2;
+    if (inc == 0 || counter > FREQ_INC_REF)
+        return max;
+
+    const uint32_t steps = (FREQ_INC_REF - counter) / inc + 1;
+    return steps < (uint32_t)max ? (int)steps : max;
+}
 
+/* Whether a channel is silent, and stays so until its registers are next
+ * written: it is off, or at volume 0 with an envelope that cannot raise it.
+ * Its length counter still has to be run. */
+__audio static bool chan_idle(const struct chan *c)
+{
     if (!c->powered || !c->enabled)
+        return true;
+
+    if (c == chans + 2)
+        return c->volume == 0;
+
+    return c->volume == 0 && !(c->env.up && c->env.step);
+}
+
+/* Whether a channel reaches either output: it is not muted, panned out or
+ * on a side at NR50 volume 0. */
+__audio static bool chan_heard(const struct chan *c)
+{
+    return !c->muted && ((c->on_left && vol_l) || (c->on_right && vol_r));
+}
+
+/* Run a channel through len samples without producing any output. Unless
+ * it is idle, its envelope and sweep still run, as the update loops would
+ * run them, so that it comes back as it would have sounded by then. */
+__audio static void chan_skip(struct chan *c, int len)
+{
+    len = update_len(c, len);
+    if (chan_idle(c) || c == chans + 2)
         return;
 
+    const bool sweep = c == chans;
+    const int n = (len + replication - 1) >> replication_shift;
+
+    for (int s = 0; s < n;)
+    {
+        int run = steps_to_ref(c->env.counter, c->env.inc, n - s);
+        if (sweep)
+            run = steps_to_ref(c->sweep.counter, c->sweep.inc, run);
+
+        /* the counters only run out on the last sample of the run */
+        c->env.counter += (run - 1) * c->env.inc;
+        update_env(c);
+        if (sweep)
+        {
+            c->sweep.counter += (run - 1) * c->sweep.inc;
+            update_sweep(c);
+            if (!c->enabled)
+                return;
+        }
+        s += run;
+    }
+}
+
+__audio static inline void square_step(struct chan *c)
+{
+    c->square.duty_counter = (c->square.duty_counter + 1) & 7;
+    c->val = (c->square.duty & (1 << c->square.duty_counter))
+                 ? CHAN_LEVEL
+                 : -CHAN_LEVEL;
+}
+
+__audio static void update_square(const bool ch2, int len)
+{
+    struct chan *c = chans + ch2;
+
+    if (chan_idle(c) || !chan_heard(c))
+    {
+        chan_skip(c, len);
+        return;
+    }
+
     uint32_t freq = DMG_CLOCK_FREQ_U / ((2048 - c->freq) << 5);
     set_note_freq(c, freq);
     c->freq_inc *= 8;
 
     len = update_len(c, len);
 
-    for (uint_fast16_t i = 0; i < len; i += AUDIO_SAMPLE_REPLICATION)
+    for (uint_fast16_t i = 0; i < len; i += replication)
     {
 
         update_env(c);
@@ -264,11 +470,9 @@ __audio static void update_square(int16_t *left, int16_t *right, const bool ch2,
 
         while (update_freq(c, &pos))
         {
-            c->square.duty_counter = (c->square.duty_counter + 1) & 7;
-            sample += ((pos - prev_pos) / c->freq_inc) * c->val;
-            c->val = (c->square.duty & (1 << c->square.duty_counter))
-                         ? VOL_INIT_MAX / MAX_CHAN_VOLUME
-                         : VOL_INIT_MIN / MAX_CHAN_VOLUME;
+            const int_fast16_t prev_val = c->val;
+            square_step(c);
+            sample += ((pos - prev_pos) / c->freq_inc) * prev_val;
             prev_pos = pos;
         }
 
@@ -277,89 +481,395 @@ __audio static void update_square(int16_t *left, int16_t *right, const bool ch2,
 
         sample += c->val;
         sample *= c->volume;
-        sample /= 4;
 
-        left[i] += sample * c->on_left * vol_l;
-        right[i] += sample * c->on_right * vol_r;
+        mix_buf[i >> replication_shift][ch2] = sample;
     }
 }
 
-__audio static uint8_t wave_sample(const unsigned int pos,
-                                   const unsigned int volume)
+__audio static void update_wave(int len)
 {
-    uint8_t sample;
+    struct chan *c = chans + 2;
 
-    sample = audio_mem[(0xFF30 + pos / 2) - AUDIO_ADDR_COMPENSATION];
-    if (pos & 1)
+    if (chan_idle(c) || !chan_heard(c))
     {
-        sample &= 0xF;
+        chan_skip(c, len);
+        return;
     }
-    else
+
+    uint32_t freq = (DMG_CLOCK_FREQ_U / 64) / (2048 - c->freq);
+    set_note_freq(c, freq);
+    c->freq_inc *= 32;
+
+    len = update_len(c, len);
+
+    const int16_t *table = wave_table[c->volume];
+
+    for (uint_fast16_t i = 0; i < len; i += replication)
     {
-        sample >>= 4;
+        /* Take this sample's steps, as update_freq would, all at once. */
+        c->freq_counter += c->freq_inc;
+        if (c->freq_counter > FREQ_INC_REF)
+        {
+            const uint32_t n = (c->freq_counter - 1) / FREQ_INC_REF;
+            c->freq_counter -= n * FREQ_INC_REF;
+            c->val = (c->val + n) & 31;
+        }
+
+        if (c->muted)
+            continue;
+
+        mix_buf[i >> replication_shift][2] = table[c->val];
     }
-    return volume ? (sample >> (volume - 1)) : 0;
 }
 
-__audio static void update_wave(int16_t *left, int16_t *right, int len)
+/* Take one step of the noise LFSR. */
+__audio static inline void noise_step(struct chan *c)
 {
-    struct chan *c = chans + 2;
+    const uint32_t *bits = c->noise.lfsr_wide ? lfsr15_bits : lfsr7_bits;
+    const uint32_t period = c->noise.lfsr_wide ? LFSR15_PERIOD : LFSR7_PERIOD;
+    const uint32_t pos = c->noise.lfsr_pos;
+
+    c->val = (bits[pos >> 5] >> (pos & 31)) & 1
+                 ? CHAN_LEVEL
+                 : -CHAN_LEVEL;
+    c->noise.lfsr_pos = pos + 1 < period ? pos + 1 : 0;
+}
 
-    if (!c->powered || !c->enabled)
+/* Take n steps of the noise LFSR, as n calls to noise_step would, and
+ * return how many of them output high. */
+__audio static uint32_t noise_steps(struct chan *c, uint32_t n)
+{
+    const uint32_t *bits = c->noise.lfsr_wide ? lfsr15_bits : lfsr7_bits;
+    const uint32_t period = c->noise.lfsr_wide ? LFSR15_PERIOD : LFSR7_PERIOD;
+    uint32_t pos = c->noise.lfsr_pos;
+    uint32_t ones = 0;
+
+    while (n > 0)
+    {
+        const uint32_t shift = pos & 31;
+        uint32_t take = MIN(32 - shift, n);
+        take = MIN(take, period - pos);
+
+        uint32_t word = bits[pos >> 5] >> shift;
+        if (take < 32)
+            word &= (1u << take) - 1;
+        ones += __builtin_popcount(word);
+
+        pos += take;
+        if (pos == period)
+            pos = 0;
+        n -= take;
+    }
+
+    const uint32_t last = (pos ? pos : period) - 1;
+    c->val = (bits[last >> 5] >> (last & 31)) & 1
+                 ? CHAN_LEVEL
+                 : -CHAN_LEVEL;
+    c->noise.lfsr_pos = pos;
+    return ones;
+}
+
+/* Mean output level of n noise steps, of which ones were high. */
+__audio static inline int_fast16_t noise_mean(const uint32_t n,
+                                              const uint32_t ones)
+{
+    return ((int32_t)(2 * ones) - (int32_t)n) *
+           CHAN_LEVEL / (int32_t)n;
+}
+
+__audio static void update_noise(int len)
+{
+    struct chan *c = chans + 3;
+
+    if (chan_idle(c) || !chan_heard(c))
+    {
+        chan_skip(c, len);
         return;
+    }
+    {
+        uint32_t freq = precomputed_noise_freqs[c->noise.lfsr_div][c->freq];
+        set_note_freq(c, freq);
 
-    uint32_t freq = (DMG_CLOCK_FREQ_U / 64) / (2048 - c->freq);
-    set_note_freq(c, freq);
-    c->freq_inc *= 32;
+        // This prevents a crash, unsure why.
+        if (c->freq_inc < 1000)
+            return;
+    }
+
+    if (c->freq >= 14)
+        c->enabled = 0;
 
     len = update_len(c, len);
 
-    for (uint_fast16_t i = 0; i < len; i += AUDIO_SAMPLE_REPLICATION)
+    if (!c->enabled)
+        return;
+
+    for (uint_fast16_t i = 0; i < len; i += replication)
     {
 
-        uint32_t pos = 0;
-        uint32_t prev_pos = 0;
-        int32_t sample = 0;
+        update_env(c);
 
-        c->wave.sample = wave_sample(c->val, c->volume);
+        int32_t sample = c->val;
 
-        while (update_freq(c, &pos))
+        /* Take this sample's steps, as update_freq would, all at once and
+         * output their mean. */
+        c->freq_counter += c->freq_inc;
+        if (c->freq_counter > FREQ_INC_REF)
         {
-            c->val = (c->val + 1) & 31;
-            sample += ((pos - prev_pos) / c->freq_inc) *
-                      ((int)c->wave.sample - 8) * (INT16_MAX / 64);
-            c->wave.sample = wave_sample(c->val, c->volume);
-            prev_pos = pos;
+            const uint32_t n = (c->freq_counter - 1) / FREQ_INC_REF;
+            c->freq_counter -= n * FREQ_INC_REF;
+            sample = noise_mean(n, noise_steps(c, n));
         }
 
-        sample += ((int)c->wave.sample - 8) * (int)(INT16_MAX / 64);
+        if (c->muted)
+            continue;
+
+        sample *= c->volume;
+
+        mix_buf[i >> replication_shift][3] = sample;
+    }
+}
+
+static void blep_init(void)
+{
+    const float pi = 3.14159265f;
+
+    for (int p = 0; p < BLEP_PHASES; ++p)
+    {
+        float k[BLEP_WIDTH];
+        float sum = 0.0f;
+
+        /* Blackman-windowed sinc, centred between taps BLEP_WIDTH / 2 - 1
+         * and BLEP_WIDTH / 2 and delayed by the phase. */
+        for (int j = 0; j < BLEP_WIDTH; ++j)
+        {
+            const float x = j - (BLEP_WIDTH / 2 - 1) - (float)p / BLEP_PHASES;
+            const float w = 0.42f + 0.5f * cosf(2 * pi * x / BLEP_WIDTH) +
+                            0.08f * cosf(4 * pi * x / BLEP_WIDTH);
+            const float a = 2 * pi * BLEP_CUTOFF * x;
+            k[j] = w * (x == 0.0f ? 1.0f : sinf(a) / a);
+            sum += k[j];
+        }
+
+        /* Each phase must sum to exactly 1 << BLEP_SHIFT, or the
+         * integrated output would drift. */
+        int total = 0;
+        int peak = 0;
+        for (int j = 0; j < BLEP_WIDTH; ++j)
+        {
+            blep_kernel[p][j] = (int16_t)lrintf(k[j] / sum * (1 << BLEP_SHIFT));
+            total += blep_kernel[p][j];
+            if (blep_kernel[p][j] > blep_kernel[p][peak])
+                peak = j;
+        }
+        blep_kernel[p][peak] += (1 << BLEP_SHIFT) - total;
+    }
+}
+
+__audio static void blep_reset(void)
+{
+    memset(blep_buf, 0, sizeof(blep_buf));
+    memset(blep_acc, 0, sizeof(blep_acc));
+    for (int i = 0; i < 4; ++i)
+        chans[i].blep_out = 0;
+}
+
+/* t is in samples at sample_rate from the start of the chunk, in
+ * 16.16 fixed point. */
+__audio static void blep_add(int32_t *buf, const uint32_t t,
+                             const int32_t delta)
+{
+    const int16_t *k =
+        blep_kernel[(t >> (16 - BLEP_PHASE_BITS)) & (BLEP_PHASES - 1)];
+
+    buf += t >> 16;
+    for (int j = 0; j < BLEP_WIDTH; ++j)
+        buf[j] += delta * k[j];
+}
+
+/* Set a channel's output level from time t on. */
+__audio static void blep_level(struct chan *c, const int32_t level,
+                               const uint32_t t)
+{
+    if (level != c->blep_out)
+    {
+        blep_add(blep_buf[c - chans], t, level - c->blep_out);
+        c->blep_out = level;
+    }
+}
+
+__audio static inline int32_t blep_chan_level(const struct chan *c,
+                                              const int_fast16_t val)
+{
+    return c->muted ? 0 : val * c->volume;
+}
+
+/* Run a square or noise channel's frequency counter for run samples from
+ * sample s, passing its level changes to blep_level. Changes within the
+ * same sample are merged into the last of them. */
+__audio static void blep_edges(struct chan *c, const int s, const int run,
+                               const bool noise)
+{
+    const uint32_t inc = c->freq_inc;
+    const uint32_t rcp = UINT32_MAX / inc;
+    const uint32_t span = run * inc;
+
+    /* Phase, from the start of the run, of the next step and of the end of
+     * the sample it falls in. */
+    uint32_t d = FREQ_INC_REF - MIN(c->freq_counter, FREQ_INC_REF);
+    uint32_t boundary = inc;
 
-        if (c->volume == 0)
+    int_fast16_t val = c->val;
+    int_fast16_t pending_val = val;
+    uint32_t pending_d = 0;
+    bool pending = false;
+
+    for (; d <= span; d += FREQ_INC_REF)
+    {
+        if (noise)
+            noise_step(c);
+        else
+            square_step(c);
+
+        if (c->val == val)
             continue;
+        val = c->val;
 
-        if (c->muted)
+        if (d > boundary)
+        {
+            if (pending)
+            {
+                blep_level(c, blep_chan_level(c, pending_val),
+                           ((uint32_t)s << 16) +
+                               (uint32_t)(((uint64_t)pending_d * rcp) >> 16));
+            }
+            do
+                boundary += inc;
+            while (d > boundary);
+        }
+        pending = true;
+        pending_d = d;
+        pending_val = val;
+    }
+
+    if (pending)
+    {
+        blep_level(c, blep_chan_level(c, pending_val),
+                   ((uint32_t)s << 16) +
+                       (uint32_t)(((uint64_t)pending_d * rcp) >> 16));
+    }
+
+    c->freq_counter = FREQ_INC_REF - (d - span);
+}
+
+/* As blep_edges for noise stepping more than once a sample: each sample's
+ * steps are taken at once, and their mean level is passed to blep_level at
+ * the start of the sample. */
+__audio static void blep_noise_steps(struct chan *c, const int s,
+                                     const int run)
+{
+    const uint32_t inc = c->freq_inc;
+    const uint32_t span = run * inc;
+
+    /* Phase, from the start of the run, of the next step. */
+    uint32_t d = FREQ_INC_REF - MIN(c->freq_counter, FREQ_INC_REF);
+
+    for (int j = 0; j < run; ++j)
+    {
+        const uint32_t end = (j + 1) * inc;
+        if (d > end)
             continue;
 
-        sample /= 4;
+        const uint32_t n = (end - d) / FREQ_INC_REF + 1;
+        d += n * FREQ_INC_REF;
+        blep_level(c,
+                   blep_chan_level(c, noise_mean(n, noise_steps(c, n))),
+                   (uint32_t)(s + j) << 16);
+    }
+
+    c->freq_counter = FREQ_INC_REF - (d - span);
+}
+
+/* Band-limited counterpart of the loops in update_square and update_noise,
+ * for n of the chunk's total samples: the envelope and sweep are stepped
+ * where their counters run out rather than every sample. */
+__audio static void blep_chan(struct chan *c, const int n, const int total,
+                              const bool sweep, const bool noise)
+{
+    for (int s = 0; s < n;)
+    {
+        update_env(c);
+        if (sweep)
+            update_sweep(c);
+
+        if (!c->enabled)
+        {
+            blep_level(c, 0, (uint32_t)s << 16);
+            return;
+        }
+        blep_level(c, blep_chan_level(c, c->val), (uint32_t)s << 16);
+
+        int run = steps_to_ref(c->env.counter, c->env.inc, n - s);
+        if (sweep)
+            run = steps_to_ref(c->sweep.counter, c->sweep.inc, run);
 
-        left[i] = sample * c->on_left * vol_l;
-        right[i] = sample * c->on_right * vol_r;
+        if (noise && c->freq_inc > FREQ_INC_REF)
+            blep_noise_steps(c, s, run);
+        else
+            blep_edges(c, s, run, noise);
+
+        c->env.counter += (run - 1) * c->env.inc;
+        if (sweep)
+            c->sweep.counter += (run - 1) * c->sweep.inc;
+        s += run;
     }
+
+    if (n < total)
+        blep_level(c, 0, (uint32_t)n << 16);
 }
 
-__audio static void update_noise(int16_t *left, int16_t *right, int len)
+__audio static void update_square_blep(const bool ch2, int len)
+{
+    struct chan *c = chans + ch2;
+    const int total = (len + replication - 1) >> replication_shift;
+
+    if (chan_idle(c) || !chan_heard(c))
+    {
+        chan_skip(c, len);
+        blep_level(c, 0, 0);
+        return;
+    }
+
+    uint32_t freq = DMG_CLOCK_FREQ_U / ((2048 - c->freq) << 5);
+    set_note_freq(c, freq);
+    c->freq_inc *= 8;
+
+    len = update_len(c, len);
+
+    blep_chan(c, (len + replication - 1) >> replication_shift, total, !ch2,
+              false);
+}
+
+__audio static void update_noise_blep(int len)
 {
     struct chan *c = chans + 3;
+    const int total = (len + replication - 1) >> replication_shift;
 
-    if (!c->powered)
+    if (chan_idle(c) || !chan_heard(c))
+    {
+        chan_skip(c, len);
+        blep_level(c, 0, 0);
         return;
+    }
     {
         uint32_t freq = precomputed_noise_freqs[c->noise.lfsr_div][c->freq];
         set_note_freq(c, freq);
 
-        // This prevents a crash, unsure why.
+        // As in update_noise.
         if (c->freq_inc < 1000)
+        {
+            blep_level(c, 0, 0);
             return;
+        }
     }
 
     if (c->freq >= 14)
@@ -367,52 +877,132 @@ __audio static void update_noise(int16_t *left, int16_t *right, int len)
 
     len = update_len(c, len);
 
-    if (!c->enabled)
-        return;
+    blep_chan(c, (len + replication - 1) >> replication_shift, total, false,
+              true);
+}
 
-    for (uint_fast16_t i = 0; i < len; i += AUDIO_SAMPLE_REPLICATION)
+/* Integrate the square and noise channels into their lanes of mix_buf. */
+__audio static void blep_mix(const int len)
+{
+    static const uint8_t blep_chans[] = {0, 1, 3};
+    const int n = (len + replication - 1) >> replication_shift;
+
+    for (unsigned j = 0; j < sizeof(blep_chans); ++j)
     {
+        const uint8_t c = blep_chans[j];
+        int32_t *buf = blep_buf[c];
+        int32_t acc = blep_acc[c];
 
-        update_env(c);
+        for (int s = 0; s < n; ++s)
+        {
+            acc += buf[s];
+            mix_buf[s][c] = acc >> BLEP_SHIFT;
+        }
+        blep_acc[c] = acc;
 
-        uint32_t pos = 0;
-        uint32_t prev_pos = 0;
-        int32_t sample = 0;
+        /* Carry the kernel tail over to the next chunk. */
+        memmove(buf, buf + n, BLEP_WIDTH * sizeof(int32_t));
+        memset(buf + BLEP_WIDTH, 0, n * sizeof(int32_t));
+    }
+}
 
-        while (update_freq(c, &pos))
-        {
-            c->noise.lfsr_reg = (c->noise.lfsr_reg << 1) |
-                                (c->val >= VOL_INIT_MAX / MAX_CHAN_VOLUME);
+__audio static inline int16_t clamp16(const int32_t x)
+{
+    return x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x;
+}
 
-            if (c->noise.lfsr_wide)
-            {
-                c->val = !(((c->noise.lfsr_reg >> 14) & 1) ^
-                           ((c->noise.lfsr_reg >> 13) & 1))
-                             ? VOL_INIT_MAX / MAX_CHAN_VOLUME
-                             : VOL_INIT_MIN / MAX_CHAN_VOLUME;
-            }
-            else
-            {
-                c->val = !(((c->noise.lfsr_reg >> 6) & 1) ^
-                           ((c->noise.lfsr_reg >> 5) & 1))
-                             ? VOL_INIT_MAX / MAX_CHAN_VOLUME
-                             : VOL_INIT_MIN / MAX_CHAN_VOLUME;
-            }
+/* Pan, scale and sum the lanes of mix_buf into every replication-th sample
+ * of the output. */
+__audio static void mix(int16_t *left, int16_t *right, const int len)
+{
+    const int32_t unit = MIX_GAIN_PER_VOL * master_gain / AUDIO_GAIN_UNITY;
+    int16_t gain_l[4], gain_r[4];
 
-            sample += ((pos - prev_pos) / c->freq_inc) * c->val;
-            prev_pos = pos;
+    for (int c = 0; c < 4; ++c)
+    {
+        gain_l[c] = chans[c].on_left * vol_l * unit;
+        gain_r[c] = chans[c].on_right * vol_r * unit;
+    }
+
+#ifdef __ARM_FEATURE_SIMD32
+    /* Channels 0 and 1, and 2 and 3, to a word; SMLAD multiplies both
+     * halves and adds them to the sum. */
+    int16x2_t gain_l01, gain_l23, gain_r01, gain_r23;
+    memcpy(&gain_l01, gain_l, sizeof(gain_l01));
+    memcpy(&gain_l23, gain_l + 2, sizeof(gain_l23));
+    memcpy(&gain_r01, gain_r, sizeof(gain_r01));
+    memcpy(&gain_r23, gain_r + 2, sizeof(gain_r23));
+
+    int s = 0;
+    for (int i = 0; i < len; i += replication, ++s)
+    {
+        int16x2_t ch01, ch23;
+        memcpy(&ch01, mix_buf[s], sizeof(ch01));
+        memcpy(&ch23, mix_buf[s] + 2, sizeof(ch23));
+
+        left[i] = __ssat(
+            __smlad(ch23, gain_l23, __smuad(ch01, gain_l01)) >> MIX_SHIFT,
+            16);
+        right[i] = __ssat(
+            __smlad(ch23, gain_r23, __smuad(ch01, gain_r01)) >> MIX_SHIFT,
+            16);
+    }
+#else
+    int s = 0;
+    for (int i = 0; i < len; i += replication, ++s)
+    {
+        int32_t l = 0, r = 0;
+        for (int c = 0; c < 4; ++c)
+        {
+            l += mix_buf[s][c] * gain_l[c];
+            r += mix_buf[s][c] * gain_r[c];
         }
+        left[i] = clamp16(l >> MIX_SHIFT);
+        right[i] = clamp16(r >> MIX_SHIFT);
+    }
+#endif
+}
 
-        if (c->muted)
-            continue;
+/* Change the synthesis rate, rescaling the channels' counters so that
+ * they keep their progress. */
+__audio static void set_replication(const uint8_t shift)
+{
+    const uint32_t old_rate = sample_rate;
 
-        sample += c->val;
-        sample *= c->volume;
-        sample /= 4;
+    replication_shift = shift;
+    replication = 1 << shift;
+    sample_rate = AUDIO_OUTPUT_RATE >> shift;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        struct chan *c = chans + i;
+        c->freq_counter = (uint64_t)c->freq_counter * sample_rate / old_rate;
+        c->len.counter = (uint64_t)c->len.counter * sample_rate / old_rate;
+        c->env.counter = (uint64_t)c->env.counter * sample_rate / old_rate;
+        c->sweep.counter = (uint64_t)c->sweep.counter * sample_rate / old_rate;
+    }
+}
+
+/* Linear interpolation to the output rate from the synthesised samples,
+ * which are in every (1 << shift)th slot of buf, running one synthesised
+ * sample behind. shift is a constant at each call, so that the inner loop
+ * unrolls. */
+__audio static inline void upsample(int16_t *buf, const int len,
+                                    int16_t *prev, const int shift)
+{
+    int32_t p = *prev;
+
+    for (int i = 0; i < len; i += 1 << shift)
+    {
+        const int32_t cur = buf[i];
+        const int32_t step = cur - p;
 
-        left[i] += sample * c->on_left * vol_l;
-        right[i] += sample * c->on_right * vol_r;
+        for (int j = 0; j < 1 << shift && i + j < len; ++j)
+            buf[i + j] = p + ((step * (j + 1)) >> shift);
+        p = cur;
     }
+
+    *prev = p;
 }
 
 static void chan_trigger(uint_fast8_t i)
@@ -424,21 +1014,21 @@ static void chan_trigger(uint_fast8_t i)
 
     // volume envelope
     {
-        uint8_t val = audio_mem[(0xFF12 + (i * 5)) - AUDIO_ADDR_COMPENSATION];
+        uint8_t val = regs[(0xFF12 + (i * 5)) - AUDIO_ADDR_COMPENSATION];
 
         c->env.step = val & 0x07;
         c->env.up = val & 0x08 ? 1 : 0;
         c->env.inc = c->env.step
                          ? (FREQ_INC_REF * 64ul) /
-                               ((uint32_t)c->env.step * AUDIO_SAMPLE_RATE)
-                         : (8ul * FREQ_INC_REF) / AUDIO_SAMPLE_RATE;
+                               ((uint32_t)c->env.step * sample_rate)
+                         : (8ul * FREQ_INC_REF) / sample_rate;
         c->env.counter = 0;
     }
 
     // freq sweep
     if (i == 0)
     {
-        uint8_t val = audio_mem[0xFF10 - AUDIO_ADDR_COMPENSATION];
+        uint8_t val = regs[0xFF10 - AUDIO_ADDR_COMPENSATION];
 
         c->sweep.freq = c->freq;
         c->sweep.rate = (val >> 4) & 0x07;
@@ -446,7 +1036,7 @@ static void chan_trigger(uint_fast8_t i)
         c->sweep.shift = (val & 0x07);
         c->sweep.inc =
             c->sweep.rate
-                ? ((128 * FREQ_INC_REF) / (c->sweep.rate * AUDIO_SAMPLE_RATE))
+                ? ((128 * FREQ_INC_REF) / (c->sweep.rate * sample_rate))
                 : 0;
         c->sweep.counter = FREQ_INC_REF;
     }
@@ -460,12 +1050,12 @@ static void chan_trigger(uint_fast8_t i)
     }
     else if (i == 3)
     {  // noise
-        c->noise.lfsr_reg = 0xFFFF;
-        c->val = VOL_INIT_MIN / MAX_CHAN_VOLUME;
+        c->noise.lfsr_pos = 0;
+        c->val = -CHAN_LEVEL;
     }
 
     c->len.inc =
-        (256 * FREQ_INC_REF) / (AUDIO_SAMPLE_RATE * (len_max - c->len.load));
+        (256 * FREQ_INC_REF) / (sample_rate * (len_max - c->len.load));
     c->len.counter = 0;
 }
 
@@ -490,29 +1080,50 @@ uint8_t audio_read(const uint16_t addr)
     };
     /* clang-format on */
 
-    return audio_mem[addr - AUDIO_ADDR_COMPENSATION] |
-           ortab[addr - AUDIO_ADDR_COMPENSATION];
+    uint8_t val = audio_mem[addr - AUDIO_ADDR_COMPENSATION] |
+                  ortab[addr - AUDIO_ADDR_COMPENSATION];
+
+    if (addr == 0xFF26 && (val & 0x80))
+        val |= chan_status;
+
+    return val;
+}
+
+/* Decode the two samples in byte i of wave RAM into wave_table. */
+__audio static void wave_decode(const uint_fast8_t i, const uint8_t val)
+{
+    const uint8_t samples[2] = {val >> 4, val & 0x0F};
+
+    for (uint_fast8_t volume = 0; volume < 4; ++volume)
+    {
+        for (uint_fast8_t j = 0; j < 2; ++j)
+        {
+            const int shifted = volume ? samples[j] >> (volume - 1) : 0;
+            wave_table[volume][i * 2 + j] =
+                (shifted - 8) * WAVE_LEVEL;
+        }
+    }
 }
 
 /**
- * Write audio register.
+ * Apply a register write to the channels.
  * \param addr  Address of audio register. Must be 0xFF10 <= addr <= 0xFF3F.
  *              This is not checked in this function.
  * \param val   Byte to write at address.
  */
-void audio_write(const uint16_t addr, const uint8_t val)
+__audio static void apu_write(const uint16_t addr, const uint8_t val)
 {
     /* Find sound channel corresponding to register address. */
     uint_fast8_t i;
 
     if (addr == 0xFF26)
     {
-        audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val & 0x80;
+        regs[addr - AUDIO_ADDR_COMPENSATION] = val & 0x80;
         /* On APU power off, clear all registers apart from wave
          * RAM. */
         if ((val & 0x80) == 0)
         {
-            memset(audio_mem, 0x00, 0xFF26 - AUDIO_ADDR_COMPENSATION);
+            memset(regs, 0x00, 0xFF26 - AUDIO_ADDR_COMPENSATION);
             chans[0].enabled = false;
             chans[1].enabled = false;
             chans[2].enabled = false;
@@ -523,10 +1134,17 @@ void audio_write(const uint16_t addr, const uint8_t val)
     }
 
     /* Ignore register writes if APU powered off. */
-    if (audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] == 0x00)
+    if (regs[0xFF26 - AUDIO_ADDR_COMPENSATION] == 0x00)
         return;
 
-    audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val;
+    regs[addr - AUDIO_ADDR_COMPENSATION] = val;
+
+    if (addr >= 0xFF30)
+    {
+        wave_decode(addr - 0xFF30, val);
+        return;
+    }
+
     i = (addr - AUDIO_ADDR_COMPENSATION) * 0.2f;
 
     switch (addr)
@@ -611,6 +1229,8 @@ void audio_write(const uint16_t addr, const uint8_t val)
         chans[3].freq = val >> 4;
         chans[3].noise.lfsr_wide = !(val & 0x08);
         chans[3].noise.lfsr_div = val & 0x07;
+        chans[3].noise.lfsr_pos %=
+            chans[3].noise.lfsr_wide ? LFSR15_PERIOD : LFSR7_PERIOD;
         break;
 
     case 0xFF24:
@@ -630,14 +1250,129 @@ void audio_write(const uint16_t addr, const uint8_t val)
     }
 }
 
+/**
+ * Write audio register. The channels hear the write when audio_callback
+ * reaches the emulated time it was made at.
+ * \param addr  Address of audio register. Must be 0xFF10 <= addr <= 0xFF3F.
+ *              This is not checked in this function.
+ * \param val   Byte to write at address.
+ * \param cycle Cycles since the start of the current frame.
+ */
+void audio_write(const uint16_t addr, const uint8_t val, const uint32_t cycle)
+{
+    if (addr == 0xFF26)
+    {
+        /* The channel status bits are kept in chan_status. */
+        audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val & 0x80;
+        if ((val & 0x80) == 0)
+        {
+            memset(audio_mem, 0x00, 0xFF26 - AUDIO_ADDR_COMPENSATION);
+        }
+    }
+    else
+    {
+        /* Ignore register writes if APU powered off. */
+        if ((audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] & 0x80) == 0)
+            return;
+
+        audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val;
+    }
+
+    const uint32_t head = queue_head;
+    if (head - QUEUE_LOAD(queue_tail) >= AUDIO_QUEUE_SIZE)
+    {
+        /* audio_callback has fallen far behind (or is not running); the
+         * write is lost to the channels. */
+        stats.overruns++;
+        return;
+    }
+
+    struct audio_event *e = &queue[head % AUDIO_QUEUE_SIZE];
+    e->time = emu_time + cycle;
+    e->reg = addr - AUDIO_ADDR_COMPENSATION;
+    e->val = val;
+    QUEUE_STORE(queue_head, head + 1);
+}
+
+void audio_end_frame(void)
+{
+    QUEUE_STORE(emu_time, emu_time + (uint32_t)SCREEN_REFRESH_CYCLES);
+}
+
+void audio_set_quality(const enum audio_quality q)
+{
+    quality_requested = q;
+}
+
+void audio_set_sample_rate(const uint32_t rate)
+{
+    uint8_t shift = 0;
+    while (shift < REPLICATION_SHIFT_MAX &&
+           (uint32_t)(AUDIO_OUTPUT_RATE >> shift) > rate)
+        ++shift;
+    replication_shift_requested = shift;
+}
+
+void audio_set_gain(const uint32_t gain)
+{
+    master_gain = MIN(gain, AUDIO_GAIN_MAX);
+}
+
+void audio_set_paced(const bool paced)
+{
+    clock_paced = paced;
+}
+
+void audio_get_stats(struct audio_stats *out)
+{
+    out->underruns = stats.underruns;
+    out->overruns = stats.overruns;
+    out->silent = stats.silent;
+    out->drift = stats.drift;
+    out->fill = (int32_t)(emu_time - QUEUE_LOAD(apu_time));
+}
+
+/* Record the output of a width-bit LFSR for one period from a trigger, at
+ * which the register is loaded with ones and the last output was low. */
+static void lfsr_init(uint32_t *bits, const uint32_t period,
+                      const unsigned width)
+{
+    uint16_t reg = 0xFFFE; /* past outputs, the last in bit 0 */
+
+    memset(bits, 0, (period + 31) / 32 * sizeof(*bits));
+    for (uint32_t i = 0; i < period; ++i)
+    {
+        const uint32_t bit =
+            !(((reg >> (width - 1)) & 1) ^ ((reg >> (width - 2)) & 1));
+        bits[i >> 5] |= bit << (i & 31);
+        reg = (reg << 1) | bit;
+    }
+}
+
 void audio_init(uint8_t *_audio_mem)
 {
     audio_mem = _audio_mem;
 
+    queue_head = queue_tail = 0;
+    emu_time = 0;
+    apu_time = -AUDIO_LATENCY_CYCLES;
+    apu_starved_at = 0;
+    chan_status = 0;
+    stats.underruns = stats.overruns = stats.silent = 0;
+    stats.drift = 0;
+    memcpy(regs, audio_mem, sizeof(regs));
+
     /* Initialise channels and samples. */
     memset(chans, 0, 4 * sizeof(struct chan));
     chans[0].val = chans[1].val = -1;
 
+    set_replication(replication_shift_requested);
+    upsample_prev_l = upsample_prev_r = 0;
+
+    blep_init();
+    blep_reset();
+    quality = quality_requested;
+
     /* Initialise IO registers. */
     { /* clang-format off */
         static const uint8_t regs_init[] = {
@@ -650,7 +1385,7 @@ void audio_init(uint8_t *_audio_mem)
         /* clang-format on */
 
         for (uint_fast8_t i = 0; i < sizeof(regs_init); ++i)
-            audio_write(0xFF10 + i, regs_init[i]);
+            apu_write(0xFF10 + i, regs_init[i]);
     }
 
     /* Initialise Wave Pattern RAM. */
@@ -664,9 +1399,14 @@ void audio_init(uint8_t *_audio_mem)
         /* clang-format on */
 
         for (uint_fast8_t i = 0; i < sizeof(wave_init); ++i)
-            audio_write(0xFF30 + i, wave_init[i]);
+            apu_write(0xFF30 + i, wave_init[i]);
     }
 
+    memcpy(audio_mem, regs, sizeof(regs));
+
+    lfsr_init(lfsr7_bits, LFSR7_PERIOD, 7);
+    lfsr_init(lfsr15_bits, LFSR15_PERIOD, 15);
+
     for (uint8_t lfsr_selector_idx = 0; lfsr_selector_idx < 8;
          ++lfsr_selector_idx)
     {
@@ -693,17 +1433,15 @@ void audio_init(uint8_t *_audio_mem)
     }
 }
 
-int audio_enabled;
+_Atomic int audio_enabled;
 
-/**
- * Playdate audio callback function.
- */
-__audio int audio_callback(void *context, int16_t *left, int16_t *right,
-                           int len)
-{
-    if (!audio_enabled)
-        return 0;
+/* audio_callback calls in progress, counted before audio_enabled is
+ * checked so that audio_suspend can wait for them to return. */
+static _Atomic uint32_t callbacks_running;
 
+__audio static int audio_callback_scene(void *context, int16_t *left,
+                                        int16_t *right, int len)
+{
     DTCM_VERIFY_DEBUG();
 
     PGB_GameScene **gameScene_ptr = context;
@@ -719,6 +1457,70 @@ __audio int audio_callback(void *context, int16_t *left, int16_t *right,
         return 0;
     }
 
+    return audio_render(left, right, len);
+}
+
+/**
+ * Playdate audio callback function.
+ */
+__audio int audio_callback(void *context, int16_t *left, int16_t *right,
+                           int len)
+{
+    callbacks_running++;
+    const int ret =
+        audio_enabled ? audio_callback_scene(context, left, right, len) : 0;
+    callbacks_running--;
+    return ret;
+}
+
+bool audio_suspend(void)
+{
+    const bool enabled = audio_enabled;
+    audio_enabled = 0;
+    while (callbacks_running)
+        ;
+    return enabled;
+}
+
+void audio_resume(const bool enabled)
+{
+    audio_enabled = enabled;
+}
+
+void audio_render_reset(void)
+{
+    /* Apply what is still queued, then rebuild the channels from the
+     * registers alone, as audio_init does. Their counters depend on how
+     * earlier callbacks were timed, so every channel starts off: a note
+     * already playing is not heard until it is retriggered. */
+    const uint32_t head = QUEUE_LOAD(queue_head);
+    while (queue_tail != head)
+    {
+        const struct audio_event *e = &queue[queue_tail % AUDIO_QUEUE_SIZE];
+        apu_write(e->reg + AUDIO_ADDR_COMPENSATION, e->val);
+        QUEUE_STORE(queue_tail, queue_tail + 1);
+    }
+
+    memset(chans, 0, 4 * sizeof(struct chan));
+    chans[0].val = chans[1].val = -1;
+    for (uint16_t addr = 0xFF10; addr < 0xFF26; ++addr)
+    {
+        const bool trigger = addr == 0xFF14 || addr == 0xFF19 ||
+                             addr == 0xFF1E || addr == 0xFF23;
+        const uint8_t val = regs[addr - AUDIO_ADDR_COMPENSATION];
+        apu_write(addr, trigger ? val & 0x7F : val);
+    }
+    for (uint_fast8_t i = 0; i < 4; ++i)
+        chan_enable(i, false);
+
+    QUEUE_STORE(apu_time, emu_time - AUDIO_LATENCY_CYCLES);
+    apu_starved_at = emu_time;
+    blep_reset();
+    upsample_prev_l = upsample_prev_r = 0;
+}
+
+__audio int audio_render(int16_t *left, int16_t *right, int len)
+{
     __builtin_prefetch(left, 1);
     __builtin_prefetch(right, 1);
 
@@ -727,30 +1529,147 @@ __audio int audio_callback(void *context, int16_t *left, int16_t *right,
     struct chan *c3 = chans + 2;
     struct chan *c4 = chans + 3;
 
-// 256, rounded up to replication
-#define MAX_CHUNK                                                        \
-    (((256 + AUDIO_SAMPLE_REPLICATION - 1) / AUDIO_SAMPLE_REPLICATION) * \
-     AUDIO_SAMPLE_REPLICATION)
+    if (quality != quality_requested)
+    {
+        quality = quality_requested;
+        blep_reset();
+    }
+
+    if (replication_shift != replication_shift_requested)
+    {
+        set_replication(replication_shift_requested);
+        blep_reset();
+    }
+
+    /* Everything queued up to here is for this buffer or later. */
+    const uint32_t head = QUEUE_LOAD(queue_head);
+    const uint32_t now = QUEUE_LOAD(emu_time);
+
+    /* The emulated time this buffer covers, nudged towards keeping
+     * AUDIO_LATENCY_CYCLES behind emulation. */
+    uint32_t start_time = apu_time;
+    uint32_t span =
+        (uint32_t)(((uint64_t)len * AUDIO_CYCLES_PER_SAMPLE) >> 16);
+    const int32_t drift =
+        (int32_t)(now - AUDIO_LATENCY_CYCLES - (start_time + span));
+    if (drift < -(int32_t)AUDIO_LATENCY_CYCLES)
+    {
+        /* Emulation has not reached the end of this buffer, so the writes
+         * it makes for this stretch will be late. Counted once per frame
+         * it happens at, however long emulation stays stalled there. */
+        if (now != apu_starved_at)
+        {
+            stats.underruns++;
+            apu_starved_at = now;
+        }
+        start_time += drift;
+        stats.drift += drift;
+    }
+    else if (drift > (int32_t)AUDIO_RESYNC_CYCLES)
+    {
+        start_time += drift;
+        stats.drift += drift;
+    }
+    else if (!clock_paced)
+    {
+        const int32_t adjust = drift >> AUDIO_CLOCK_GAIN_SHIFT;
+        const int32_t stretched =
+            MAX((int32_t)span / 2, (int32_t)span + adjust);
+        stats.drift += stretched - (int32_t)span;
+        span = stretched;
+    }
+    const uint32_t end_time = start_time + span;
+    QUEUE_STORE(apu_time, end_time);
+
+    /* Every channel is silent and no register write falls due before the
+     * end of this buffer, so there is nothing to play. */
+    if ((chan_idle(c1) || !chan_heard(c1)) &&
+        (chan_idle(c2) || !chan_heard(c2)) &&
+        (chan_idle(c3) || !chan_heard(c3)) &&
+        (chan_idle(c4) || !chan_heard(c4)) &&
+        (queue_tail == head ||
+         (int32_t)(queue[queue_tail % AUDIO_QUEUE_SIZE].time - end_time) >= 0))
+    {
+        for (int i = 0; i < 4; ++i)
+            chan_skip(chans + i, len);
+
+        /* Only the kernel tail of the last level change is lost; the
+         * upsampler starts again from silence. */
+        blep_reset();
+        upsample_prev_l = upsample_prev_r = 0;
+
+        stats.silent++;
+        return 0;
+    }
+
+    const int total_len = len;
+    int done = 0;
+
     while (len > 0)
     {
         int chunksize = len >= MAX_CHUNK ? MAX_CHUNK : len;
 
-        update_wave(left, right, chunksize);
-        update_square(left, right, 0, chunksize);
-        update_square(left, right, 1, chunksize);
-        update_noise(left, right, chunksize);
-
-        for (int i = 0; i < chunksize; i += AUDIO_SAMPLE_REPLICATION)
+        /* Replay the writes due by the start of this chunk, and stop it
+         * short at the next one. Offsets are rounded down to whole
+         * replicated samples. */
+        while (queue_tail != head)
         {
-            for (int j = i; j < i + AUDIO_SAMPLE_REPLICATION && j < chunksize;
-                 ++j)
+            const struct audio_event *e =
+                &queue[queue_tail % AUDIO_QUEUE_SIZE];
+            const int32_t dt = (int32_t)(e->time - start_time);
+            int offset = 0;
+            if (dt > 0)
+            {
+                offset = (int)(MIN((uint64_t)dt * total_len / span,
+                                   (uint64_t)total_len));
+                offset &= ~(replication - 1);
+                offset -= done;
+            }
+
+            if (offset > 0)
             {
-                left[j] = left[i];
-                right[j] = right[i];
+                if (offset < chunksize)
+                    chunksize = offset;
+                break;
             }
+
+            apu_write(e->reg + AUDIO_ADDR_COMPENSATION, e->val);
+            QUEUE_STORE(queue_tail, queue_tail + 1);
+        }
+
+        memset(mix_buf, 0,
+               ((chunksize + replication - 1) >> replication_shift) *
+                   sizeof(mix_buf[0]));
+
+        update_wave(chunksize);
+        if (quality == AUDIO_QUALITY_BLEP)
+        {
+            update_square_blep(0, chunksize);
+            update_square_blep(1, chunksize);
+            update_noise_blep(chunksize);
+            blep_mix(chunksize);
+        }
+        else
+        {
+            update_square(0, chunksize);
+            update_square(1, chunksize);
+            update_noise(chunksize);
+        }
+        mix(left, right, chunksize);
+
+        if (replication_shift == 1)
+        {
+            upsample(left, chunksize, &upsample_prev_l, 1);
+            upsample(right, chunksize, &upsample_prev_r, 1);
+        }
+        else if (replication_shift == 2)
+        {
+            upsample(left, chunksize, &upsample_prev_l, 2);
+            upsample(right, chunksize, &upsample_prev_r, 2);
         }
 
         len -= chunksize;
+        done += chunksize;
         left += chunksize;
         right += chunksize;
     }
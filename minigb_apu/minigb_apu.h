@@ -7,23 +7,19 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
-// increasing AUDIO_SAMPLE_REPLICATION saves processing time,
-// but lowers audio quality. (duplicates, triplicates samples, etc.)
-// does not need to be a power of 2.
-// 2 seems to be a good middle ground between perf and audio quality.
-#define AUDIO_SAMPLE_REPLICATION 2
-#define AUDIO_SAMPLE_RATE (44100 / AUDIO_SAMPLE_REPLICATION)
+// the rate audio_callback produces. Sound is synthesised at this rate or
+// a half or quarter of it (see audio_set_sample_rate), and upsampled.
+#define AUDIO_OUTPUT_RATE 44100
 
 #define DMG_CLOCK_FREQ 4194304.0
 #define SCREEN_REFRESH_CYCLES 70224.0
 #define VERTICAL_SYNC (DMG_CLOCK_FREQ / SCREEN_REFRESH_CYCLES)
 
-#define AUDIO_SAMPLES ((unsigned)(AUDIO_SAMPLE_RATE / VERTICAL_SYNC))
-
-// master audio control
-extern int audio_enabled;
+// master audio control; audio_callback renders nothing while it is 0
+extern _Atomic int audio_enabled;
 
 /**
  * Read audio register at given address "addr".
@@ -31,12 +27,84 @@ extern int audio_enabled;
 uint8_t audio_read(const uint16_t addr);
 
 /**
- * Write "val" to audio register at given address "addr".
+ * Write "val" to audio register at given address "addr", "cycle" cycles
+ * after the start of the current frame.
+ */
+void audio_write(const uint16_t addr, const uint8_t val, const uint32_t cycle);
+
+/**
+ * Advance to the next frame, after the emulator has run one.
+ */
+void audio_end_frame(void);
+
+/**
+ * How the square and noise channels are synthesised.
+ */
+enum audio_quality
+{
+    /* Stepped once per sample; cheap, but aliases at high notes. */
+    AUDIO_QUALITY_FAST,
+    /* Band-limited steps; costs more with more level changes. */
+    AUDIO_QUALITY_BLEP,
+};
+
+/**
+ * Select the synthesis quality. Takes effect from the next audio callback.
+ */
+void audio_set_quality(enum audio_quality quality);
+
+/**
+ * Select the synthesis rate: AUDIO_OUTPUT_RATE, or a half or quarter of it
+ * (other rates are rounded down to one of these). Lower rates save
+ * processing time but lose high frequencies. Takes effect from the next
+ * audio callback.
+ */
+void audio_set_sample_rate(uint32_t rate);
+
+/**
+ * Master gain, in units of 1/AUDIO_GAIN_UNITY. At unity, all four channels
+ * at full volume reach full scale; louder mixes saturate.
+ */
+#define AUDIO_GAIN_UNITY 256
+#define AUDIO_GAIN_MAX (2 * AUDIO_GAIN_UNITY)
+
+/**
+ * Set the master gain, up to AUDIO_GAIN_MAX. Takes effect from the next
+ * audio callback.
  */
-void audio_write(const uint16_t addr, const uint8_t val);
+void audio_set_gain(uint32_t gain);
 
 /**
- * Initialise audio driver.
+ * Counters for tuning the handoff between emulation and audio_callback.
+ */
+struct audio_stats
+{
+    /* Times audio_callback caught up with emulation. */
+    uint32_t underruns;
+    /* Register writes dropped because the queue was full. */
+    uint32_t overruns;
+    /* Callbacks skipped because all channels were silent. */
+    uint32_t silent;
+    /* Total adjustment of the audio clock to follow emulation, in cycles:
+     * positive where emulation ran ahead and sound was skipped, negative
+     * where it fell behind and sound was stretched. */
+    int32_t drift;
+    /* Cycles of emulation queued ahead of audio_callback, as of the call. */
+    int32_t fill;
+};
+
+void audio_get_stats(struct audio_stats *stats);
+
+/**
+ * Whether the caller paces emulation to keep the fill level in
+ * audio_stats steady. If so, audio_callback plays at the nominal rate
+ * rather than following emulation, apart from resynchronising when the
+ * fill level is far out.
+ */
+void audio_set_paced(bool paced);
+
+/**
+ * Initialise audio driver. The audio callback must not be running.
  */
 void audio_init(uint8_t *audio_mem);
 
@@ -44,3 +112,32 @@ void audio_init(uint8_t *audio_mem);
  * Playdate audio callback function.
  */
 int audio_callback(void *context, int16_t *left, int16_t *right, int len);
+
+/**
+ * Synthesise len samples at AUDIO_OUTPUT_RATE into left and right, as
+ * audio_callback does once it has checked the game scene. Returns 0, and
+ * leaves the buffers untouched, if there was nothing to play. Only for use
+ * while audio_callback is not installed or is suspended, e.g. to render
+ * offline.
+ */
+int audio_render(int16_t *left, int16_t *right, int len);
+
+/**
+ * Stop audio_callback from rendering, and wait for a call in progress to
+ * return, so that audio_render may be called from this thread. Returns
+ * whether audio was enabled, for audio_resume.
+ */
+bool audio_suspend(void);
+
+/**
+ * Let audio_callback render again if enabled, after audio_suspend.
+ */
+void audio_resume(bool enabled);
+
+/**
+ * Restart the audio clock AUDIO_LATENCY_CYCLES behind emulation, with every
+ * channel off and set up from the registers alone, so that what
+ * audio_render produces from here on does not depend on where
+ * audio_callback left off. Only while audio_callback is suspended.
+ */
+void audio_render_reset(void);
@@ -64,6 +64,12 @@ typedef int16_t s16;
 #define ENABLE_BGCACHE_DEFERRED 1
 #endif
 
+/* Keeps every sprite tile row pre-packed, in both X orientations.
+ * Maintained by __gb_write_vram, so requires ENABLE_BGCACHE. */
+#ifndef ENABLE_SPRITECACHE
+#define ENABLE_SPRITECACHE ENABLE_BGCACHE
+#endif
+
 /* Enable LCD drawing. On by default. May be turned off for testing purposes. */
 #ifndef ENABLE_LCD
 #define ENABLE_LCD 1
@@ -82,6 +88,9 @@ typedef int16_t s16;
 #define CONTROL_INTR 0x10
 #define ANY_INTR 0x1F
 
+/* gb_init_joypad: sample when the game polls P1, rather than at a line. */
+#define JOYPAD_SAMPLE_ON_P1 0xFF
+
 /* Memory section sizes for DMG */
 #define WRAM_SIZE 0x2000
 #define VRAM_SIZE 0x2000
@@ -164,6 +173,11 @@ typedef int16_t s16;
 #define BGCACHE_SIZE (2 * 2 * 256 * 256 / 4)
 #define BGCACHE_STRIDE (256 / 4)
 
+// 256 tiles
+// 8 lines
+// 2 orientations (normal, X-flipped)
+#define SPRITECACHE_SIZE (256 * 8 * 2)
+
 /* VRAM Locations */
 #define VRAM_TILES_1 (0x8000 - VRAM_ADDR)
 #define VRAM_TILES_2 (0x8800 - VRAM_ADDR)
@@ -396,6 +410,14 @@ struct gb_s
     void (*gb_serial_tx)(struct gb_s *, const uint8_t tx);
     enum gb_serial_rx_ret_e (*gb_serial_rx)(struct gb_s *, uint8_t *rx);
 
+    /* Re-read the buttons into direct.joypad during a frame (optional;
+     * see gb_init_joypad). */
+    void (*gb_joypad_sample)(struct gb_s *);
+    uint8_t joypad_sample_line;
+
+    /* Cycles the CPU spent in HALT this frame. */
+    uint32_t halt_cycles;
+
     // shortcut to swappable bank (addr - 0x4000 offset built in)
     uint8_t *selected_bank_addr;
 
@@ -405,6 +427,11 @@ struct gb_s
         uint8_t gb_ime : 1;
         uint8_t gb_bios_enable : 1;
         uint8_t gb_frame : 1; /* New frame drawn. */
+        /* OAM changed since sprite_lines was built. */
+        uint8_t oam_dirty : 1;
+        uint8_t joypad_sampled : 1; /* gb_joypad_sample called this frame. */
+        /* VRAM, OAM or a register affecting the picture changed this frame. */
+        uint8_t display_written : 1;
 
 #define LCD_HBLANK 0
 #define LCD_VBLANK 1
@@ -432,6 +459,7 @@ struct gb_s
     uint8_t enable_cart_ram;
     /* Cartridge ROM/RAM mode select. */
     uint8_t cart_mode_select;
+    /* Latched RTC registers, as the game reads them. */
     union
     {
         struct
@@ -444,6 +472,11 @@ struct gb_s
         } rtc_bits;
         uint8_t cart_rtc[5];
     };
+    /* RTC counter (see gb_init_rtc). */
+    uint32_t (*gb_rtc_now)(struct gb_s *);
+    uint32_t rtc_epoch;
+    uint32_t rtc_count; /* last count read, in case the clock goes back */
+    uint8_t rtc_flags;
 
     union
     {
@@ -464,29 +497,31 @@ struct gb_s
     struct
     {
         /**
-         * Draw line on screen.
+         * Draw line on screen. Optional; may be NULL.
+         *
+         * Called after each line has been rendered into gb->lcd.
          *
          * \param gb_s      emulator context
-         * \param pixels    The 160 pixels to draw.
-         *                  Bits 1-0 are the colour to draw.
-         *                  Bits 5-4 are the palette, where:
-         *                      OBJ0 = 0b00,
-         *                      OBJ1 = 0b01,
-         *                      BG = 0b10
-         *                  Other bits are undefined.
-         *                  Bits 5-4 are only required by front-ends
-         *                  which want to use a different colour for
-         *                  different object palettes. This is what
-         *                  the Game Boy Color (CGB) does to DMG
-         *                  games.
+         * \param pixels    The 160 pixels just drawn, packed 2 bits per
+         *                  pixel (LCD_WIDTH_PACKED bytes), leftmost pixel
+         *                  in the low bits of the first byte.
          * \param line      Line to draw pixels on. This is
          *                  guaranteed to be between 0-144 inclusive.
          */
+        void (*lcd_draw_line)(struct gb_s *gb, const uint8_t *pixels,
+                              const uint_fast8_t line);
+
+        /* Scanline renderer specialised for the current LCDC. */
+        void (*draw_line)(struct gb_s *restrict gb);
 
         /* Palettes */
         uint8_t bg_palette[4];
         uint8_t sp_palette[8];
 
+        /* Palette lookup tables, [3][256]: BGP, OBP0, OBP1.
+         * See __gb_update_palette_lut. */
+        uint8_t *palette_lut;
+
         uint8_t window_clear;
         uint8_t WY;
 
@@ -556,58 +591,160 @@ struct gb_s
     uint32_t dirty_tiles[64];
 #endif
 #endif
+
+#if ENABLE_SPRITECACHE
+    // [tile * 8 + line][flip_x] -> __gb_sprite_row
+    uint16_t *spritecache;
+#endif
+
+    // [LY] -> bit n set if sprite n covers the line, for sprites of the
+    // height sprite_lines_tall; see __gb_update_sprite_lines
+    uint64_t *sprite_lines;
+    bool sprite_lines_tall;
 };
 
 #ifdef PGB_IMPL
 
-/**
- * Tick the internal RTC by one second.
- * This was taken from SameBoy, which is released under MIT Licence.
+/*
+ * MBC3 real-time clock. Rather than being ticked, the counter is kept as the
+ * front-end's wall-clock time at which it read zero (or, while halted, as
+ * the frozen count itself); the registers are derived from it whenever the
+ * game latches or writes them, so any amount of elapsed time costs O(1).
  */
-__section__(".text.pgb") void gb_tick_rtc(struct gb_s *gb)
+
+/* the counter wraps after 512 days, setting the day counter's carry bit */
+#define RTC_PERIOD_S (512u * 24 * 60 * 60)
+#define RTC_HALT 0x40
+#define RTC_CARRY 0x80
+
+/* seconds on the counter now */
+__section__(".text.pgb") static uint32_t __gb_rtc_counter(struct gb_s *gb)
 {
-    /* is timer running? */
-    if ((gb->cart_rtc[4] & 0x40) == 0)
+    if ((gb->rtc_flags & RTC_HALT) || !gb->gb_rtc_now)
+        return gb->rtc_epoch;
+
+    const uint32_t now = gb->gb_rtc_now(gb);
+    uint32_t c = now - gb->rtc_epoch;
+    if ((int32_t)c < 0)
     {
-        if (++gb->rtc_bits.sec == 60)
-        {
-            gb->rtc_bits.sec = 0;
+        /* the wall clock was set back: carry on from the last count */
+        gb->rtc_epoch = now - gb->rtc_count;
+        return gb->rtc_count;
+    }
 
-            if (++gb->rtc_bits.min == 60)
-            {
-                gb->rtc_bits.min = 0;
+    if (c >= RTC_PERIOD_S)
+    {
+        const uint32_t wraps = c / RTC_PERIOD_S;
+        gb->rtc_epoch += wraps * RTC_PERIOD_S;
+        gb->rtc_flags |= RTC_CARRY;
+        c -= wraps * RTC_PERIOD_S;
+    }
 
-                if (++gb->rtc_bits.hour == 24)
-                {
-                    gb->rtc_bits.hour = 0;
+    gb->rtc_count = c;
+    return c;
+}
 
-                    if (++gb->rtc_bits.yday == 0)
-                    {
-                        if (gb->rtc_bits.high & 1) /* Bit 8 of days*/
-                        {
-                            gb->rtc_bits.high |= 0x80; /* Overflow bit */
-                        }
+/* sets the counter to c seconds, as of now; flags as in the DH register */
+__section__(".text.pgb") static void __gb_rtc_set_counter(struct gb_s *gb,
+                                                          uint32_t c,
+                                                          uint8_t flags)
+{
+    gb->rtc_flags = flags & (RTC_HALT | RTC_CARRY);
+    if (c >= RTC_PERIOD_S)
+    {
+        c %= RTC_PERIOD_S;
+        gb->rtc_flags |= RTC_CARRY;
+    }
 
-                        gb->rtc_bits.high ^= 1;
-                    }
-                }
-            }
-        }
+    gb->rtc_count = c;
+    if ((gb->rtc_flags & RTC_HALT) || !gb->gb_rtc_now)
+        gb->rtc_epoch = c;
+    else
+        gb->rtc_epoch = gb->gb_rtc_now(gb) - c;
+}
+
+/* sec, min, hour, day low, day high (with flags) */
+__section__(".text.pgb") static void __gb_rtc_to_regs(const uint32_t c,
+                                                      const uint8_t flags,
+                                                      uint8_t regs[5])
+{
+    const uint32_t days = c / (24 * 60 * 60);
+    regs[0] = c % 60;
+    regs[1] = (c / 60) % 60;
+    regs[2] = (c / (60 * 60)) % 24;
+    regs[3] = days & 0xFF;
+    regs[4] = ((days >> 8) & 1) | flags;
+}
+
+__section__(".text.pgb") static uint32_t __gb_rtc_from_regs(
+    const uint8_t regs[5])
+{
+    const uint32_t days = regs[3] | ((regs[4] & 1) << 8);
+    return regs[0] + regs[1] * 60 + regs[2] * (60 * 60) +
+           days * (24 * 60 * 60);
+}
+
+/* copies the counter into the registers the game reads */
+__section__(".text.pgb") static void __gb_rtc_latch(struct gb_s *gb)
+{
+    const uint32_t c = __gb_rtc_counter(gb);
+    __gb_rtc_to_regs(c, gb->rtc_flags, gb->cart_rtc);
+}
+
+__section__(".text.pgb") static void __gb_rtc_write(struct gb_s *gb,
+                                                    const size_t idx,
+                                                    const uint8_t val)
+{
+    static const uint8_t RTC_REG_MASK[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+
+    /* banks 0x0D-0x0F select no register */
+    if (idx >= PEANUT_GB_ARRAYSIZE(RTC_REG_MASK))
+        return;
+
+    uint8_t regs[5];
+    const uint32_t c = __gb_rtc_counter(gb);
+    __gb_rtc_to_regs(c, gb->rtc_flags, regs);
+    regs[idx] = val & RTC_REG_MASK[idx];
+    __gb_rtc_set_counter(gb, __gb_rtc_from_regs(regs), regs[4]);
+
+    gb->cart_rtc[idx] = regs[idx];
+    gb->direct.sram_updated = 1;
+}
+
+/**
+ * Set up the RTC. Should be called after gb_init().
+ * now() returns the current time in seconds, from any fixed epoch; it is
+ * only called when the game latches or writes the RTC.
+ * regs are the sec, min, hour, day low and day high registers as they were
+ * seconds_ago seconds ago; the clock catches up over the gap at once.
+ */
+__section__(".text.pgb") void gb_init_rtc(struct gb_s *gb,
+                                          uint32_t (*now)(struct gb_s *),
+                                          const uint8_t regs[5],
+                                          uint32_t seconds_ago)
+{
+    uint32_t c = __gb_rtc_from_regs(regs);
+    uint8_t flags = regs[4];
+
+    if (!(flags & RTC_HALT))
+    {
+        if (seconds_ago >= RTC_PERIOD_S)
+            flags |= RTC_CARRY;
+        c += seconds_ago % RTC_PERIOD_S;
     }
+
+    gb->gb_rtc_now = now;
+    __gb_rtc_set_counter(gb, c, flags);
+    __gb_rtc_latch(gb);
 }
 
 /**
- * Set initial values in RTC.
- * Should be called after gb_init().
+ * Read the RTC registers as they are now (e.g. to save them).
  */
-__section__(".text.pgb") void gb_set_rtc(struct gb_s *gb,
-                                         const struct tm *const time)
+__section__(".text.pgb") void gb_get_rtc(struct gb_s *gb, uint8_t regs[5])
 {
-    gb->cart_rtc[0] = time->tm_sec;
-    gb->cart_rtc[1] = time->tm_min;
-    gb->cart_rtc[2] = time->tm_hour;
-    gb->cart_rtc[3] = time->tm_yday & 0xFF; /* Low 8 bits of day counter. */
-    gb->cart_rtc[4] = time->tm_yday >> 8;   /* High 1 bit of day counter. */
+    const uint32_t c = __gb_rtc_counter(gb);
+    __gb_rtc_to_regs(c, gb->rtc_flags, regs);
 }
 
 __section__(".text.pgb") static void __gb_update_tac(struct gb_s *gb)
@@ -662,7 +799,12 @@ __shell uint8_t __gb_read_full(struct gb_s *gb, const uint_fast16_t addr)
         if (gb->cart_ram && gb->enable_cart_ram)
         {
             if (gb->mbc == 3 && gb->cart_ram_bank >= 0x08)
-                return gb->cart_rtc[gb->cart_ram_bank - 0x08];
+            {
+                const size_t idx = gb->cart_ram_bank - 0x08;
+                return idx < PEANUT_GB_ARRAYSIZE(gb->cart_rtc)
+                           ? gb->cart_rtc[idx]
+                           : 0xFF;
+            }
             else if ((gb->cart_mode_select || gb->mbc != 1) &&
                      gb->cart_ram_bank < gb->num_ram_banks)
             {
@@ -808,6 +950,36 @@ __shell uint8_t __gb_read_full(struct gb_s *gb, const uint_fast16_t addr)
     return 0xFF;
 }
 
+/* reverses the bit order of a byte */
+__attribute__((always_inline)) static inline uint8_t __gb_reverse_bits(
+    uint32_t b)
+{
+    b = ((b & 0xF0) >> 4) | ((b & 0x0F) << 4);
+    b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
+    b = ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
+    return b;
+}
+
+/* spreads the 8 bits of b to the even bits of a 16-bit word */
+__attribute__((always_inline)) static inline uint32_t __gb_spread_bits(
+    uint32_t b)
+{
+    b = (b | (b << 4)) & 0x0F0F;
+    b = (b | (b << 2)) & 0x3333;
+    b = (b | (b << 1)) & 0x5555;
+    return b;
+}
+
+/* packs a tile row (one byte per bit plane) into 8 2bpp colour indices, with
+ * bit 7 (the leftmost pixel unless X-flipped) in the low bits */
+__attribute__((always_inline)) static inline uint16_t __gb_sprite_row(
+    const uint8_t t1, const uint8_t t2, const bool flip_x)
+{
+    const uint32_t r1 = flip_x ? t1 : __gb_reverse_bits(t1);
+    const uint32_t r2 = flip_x ? t2 : __gb_reverse_bits(t2);
+    return __gb_spread_bits(r1) | (__gb_spread_bits(r2) << 1);
+}
+
 #if ENABLE_BGCACHE
 #if ENABLE_BGCACHE_DEFERRED
 
@@ -963,6 +1135,17 @@ void __gb_write_vram(struct gb_s *gb, uint_fast16_t addr, const uint8_t val)
     if (gb->vram[addr] == val)
         return;
     gb->vram[addr] = val;
+    gb->display_written = 1;
+#if ENABLE_SPRITECACHE
+    if (addr < 0x1000)
+    {
+        const uint8_t t1 = gb->vram[addr & ~1];
+        const uint8_t t2 = gb->vram[addr | 1];
+        uint16_t *row = &gb->spritecache[(addr / 2) * 2];
+        row[0] = __gb_sprite_row(t1, t2, false);
+        row[1] = __gb_sprite_row(t1, t2, true);
+    }
+#endif
     if (addr < 0x1800)
     {
         unsigned tile = (addr / 16);
@@ -977,6 +1160,135 @@ void __gb_write_vram(struct gb_s *gb, uint_fast16_t addr, const uint8_t val)
 }
 #endif
 
+#if ENABLE_LCD
+static void __gb_select_draw_line(struct gb_s *gb);
+#endif
+
+/**
+ * Regenerates a palette lookup table, which maps 4 pixels at a time to
+ * packed 2bpp shades (leftmost pixel in the low bits).
+ *
+ * planar: the index is a nibble of each bit plane, (plane 0 | plane 1 << 4),
+ *         as stored in the background cache.
+ * otherwise: the index is 4 packed 2bpp colour indices.
+ *
+ * Each entry is put together from two pixel pairs, looked up in a 16-entry
+ * table built first.
+ */
+static void __gb_update_palette_lut(uint8_t *lut, const uint8_t pal,
+                                    const bool planar)
+{
+    uint8_t pair[16];
+
+    for (unsigned k = 0; k < 16; ++k)
+    {
+        unsigned c0 = planar ? (k & 1) | ((k >> 1) & 2) : k & 3;
+        unsigned c1 = planar ? ((k >> 1) & 1) | ((k >> 2) & 2) : k >> 2;
+        pair[k] = ((pal >> (2 * c0)) & 3) | (((pal >> (2 * c1)) & 3) << 2);
+    }
+
+    for (unsigned idx = 0; idx < 256; ++idx)
+    {
+        unsigned lo = planar ? (idx & 3) | ((idx >> 2) & 0xC) : idx & 0xF;
+        unsigned hi = planar ? ((idx >> 2) & 3) | ((idx >> 4) & 0xC) : idx >> 4;
+        lut[idx] = pair[lo] | (pair[hi] << 4);
+    }
+}
+
+/**
+ * Host memory an OAM DMA from the given page copies, laid out as on the Game
+ * Boy (a page never crosses a bank), or NULL if it must be read byte by byte
+ * through __gb_read_full (cartridge RAM that is disabled or mapped to RTC).
+ */
+static const uint8_t *__gb_dma_source(struct gb_s *gb, const uint8_t page)
+{
+    const uint_fast16_t addr = page << 8;
+
+    switch (addr >> 12)
+    {
+    case 0x0:
+    case 0x1:
+    case 0x2:
+    case 0x3:
+        return gb->gb_rom + addr;
+
+    case 0x4:
+    case 0x5:
+    case 0x6:
+    case 0x7:
+        return gb->selected_bank_addr + addr;
+
+    case 0x8:
+    case 0x9:
+        return gb->vram + (addr - VRAM_ADDR);
+
+    case 0xA:
+    case 0xB:
+        if (!gb->cart_ram || !gb->enable_cart_ram ||
+            (gb->mbc == 3 && gb->cart_ram_bank >= 0x08))
+            return NULL;
+        if ((gb->cart_mode_select || gb->mbc != 1) &&
+            gb->cart_ram_bank < gb->num_ram_banks)
+            return gb->gb_cart_ram + (addr - CART_RAM_ADDR) +
+                   gb->cart_ram_bank * CRAM_BANK_SIZE;
+        return gb->gb_cart_ram + (addr - CART_RAM_ADDR);
+
+    case 0xC:
+    case 0xD:
+        return gb->wram + (addr - WRAM_0_ADDR);
+
+    default:
+        /* echo RAM; the DMA register stops at 0xF0 */
+        return gb->wram + (addr - ECHO_ADDR);
+    }
+}
+
+/**
+ * Asks the front-end for the current buttons, at most once per frame.
+ * Raises the joypad interrupt if a button was newly pressed, and refreshes
+ * the inputs of the selected P1 group.
+ */
+__shell static void __gb_sample_joypad(struct gb_s *gb)
+{
+    if (!gb->gb_joypad_sample || gb->joypad_sampled)
+        return;
+
+    gb->joypad_sampled = 1;
+
+    const uint8_t prev = gb->direct.joypad;
+    gb->gb_joypad_sample(gb);
+
+    /* Buttons are active low. Only a press in a group that P1 selects
+     * pulls an input line low and requests the interrupt: P14 selects the
+     * directions (high nibble), P15 the buttons (low nibble). */
+    uint8_t selected = 0;
+    if ((gb->gb_reg.P1 & 0b010000) == 0)
+        selected |= 0xF0;
+    if ((gb->gb_reg.P1 & 0b100000) == 0)
+        selected |= 0x0F;
+    if (prev & ~gb->direct.joypad & selected)
+        gb->gb_reg.IF |= CONTROL_INTR;
+
+    gb->gb_reg.P1 &= 0x30;
+    if ((gb->gb_reg.P1 & 0b010000) == 0)
+        gb->gb_reg.P1 |= (gb->direct.joypad >> 4);
+    else
+        gb->gb_reg.P1 |= (gb->direct.joypad & 0x0F);
+}
+
+#if ENABLE_SOUND
+/**
+ * Cycles since the current frame started, at the beginning of VBLANK.
+ */
+static inline uint32_t __gb_frame_cycle(const struct gb_s *gb)
+{
+    unsigned line = gb->gb_reg.LY >= LCD_HEIGHT
+                        ? gb->gb_reg.LY - LCD_HEIGHT
+                        : gb->gb_reg.LY + (LCD_VERT_LINES - LCD_HEIGHT);
+    return line * LCD_LINE_CYCLES + gb->counter.lcd_count;
+}
+#endif
+
 /**
  * Internal function used to write bytes.
  */
@@ -1057,6 +1369,9 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
 
     case 0x6:
     case 0x7:
+        /* MBC3 latches the RTC on writing 0 then 1. */
+        if (gb->mbc == 3 && !gb->cart_mode_select && (val & 1))
+            __gb_rtc_latch(gb);
         gb->cart_mode_select = (val & 1);
         return;
 
@@ -1065,6 +1380,7 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
 #if ENABLE_BGCACHE
         __gb_write_vram(gb, addr, val);
 #else
+        gb->display_written |= gb->vram[addr - VRAM_ADDR] != val;
         gb->vram[addr - VRAM_ADDR] = val;
 #endif
         return;
@@ -1076,9 +1392,7 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
             const u8 prev = gb->gb_cart_ram[addr - CART_RAM_ADDR];
             if (gb->mbc == 3 && gb->cart_ram_bank >= 0x08)
             {
-                size_t idx = gb->cart_ram_bank - 0x08;
-                PGB_ASSERT(idx < PEANUT_GB_ARRAYSIZE(gb->cart_rtc));
-                gb->cart_rtc[idx] = val;
+                __gb_rtc_write(gb, gb->cart_ram_bank - 0x08, val);
             }
             else if (gb->cart_mode_select &&
                      gb->cart_ram_bank < gb->num_ram_banks)
@@ -1120,6 +1434,11 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
 
         if (addr < UNUSED_ADDR)
         {
+            if (gb->oam[addr - OAM_ADDR] != val)
+            {
+                gb->oam_dirty = 1;
+                gb->display_written = 1;
+            }
             gb->oam[addr - OAM_ADDR] = val;
             return;
         }
@@ -1138,7 +1457,7 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
         {
             if (gb->direct.sound)
             {
-                audio_write(addr, val);
+                audio_write(addr, val, __gb_frame_cycle(gb));
             }
             else
             {
@@ -1157,6 +1476,9 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
              * significant bits are unused. */
             gb->gb_reg.P1 = val;
 
+            if (gb->joypad_sample_line == JOYPAD_SAMPLE_ON_P1)
+                __gb_sample_joypad(gb);
+
             /* Direction keys selected */
             if ((gb->gb_reg.P1 & 0b010000) == 0)
                 gb->gb_reg.P1 |= (gb->direct.joypad >> 4);
@@ -1206,7 +1528,11 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
                 gb->lcd_blank = 1;
             }
 
+            gb->display_written |= gb->gb_reg.LCDC != val;
             gb->gb_reg.LCDC = val;
+#if ENABLE_LCD
+            __gb_select_draw_line(gb);
+#endif
 
             /* LY fixed to 0 when LCD turned off. */
             if ((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
@@ -1231,10 +1557,12 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
             return;
 
         case 0x42:
+            gb->display_written |= gb->gb_reg.SCY != val;
             gb->gb_reg.SCY = val;
             return;
 
         case 0x43:
+            gb->display_written |= gb->gb_reg.SCX != val;
             gb->gb_reg.SCX = val;
             return;
 
@@ -1245,44 +1573,83 @@ __shell void __gb_write_full(struct gb_s *gb, const uint_fast16_t addr,
 
         /* DMA Register */
         case 0x46:
+        {
             gb->gb_reg.DMA = (val % 0xF1);
 
+            const uint8_t *src = __gb_dma_source(gb, gb->gb_reg.DMA);
+            if likely (src)
+            {
+                /* most games copy OAM every frame, changed or not */
+                if (memcmp(gb->oam, src, OAM_SIZE) != 0)
+                {
+                    memcpy(gb->oam, src, OAM_SIZE);
+                    gb->oam_dirty = 1;
+                    gb->display_written = 1;
+                }
+                return;
+            }
+
+            uint8_t changed = 0;
             for (uint8_t i = 0; i < OAM_SIZE; i++)
-                gb->oam[i] = __gb_read_full(gb, (gb->gb_reg.DMA << 8) + i);
+            {
+                const uint8_t v = __gb_read_full(gb, (gb->gb_reg.DMA << 8) + i);
+                changed |= gb->oam[i] ^ v;
+                gb->oam[i] = v;
+            }
+            gb->oam_dirty |= changed != 0;
+            gb->display_written |= changed != 0;
 
             return;
+        }
 
         /* DMG Palette Registers */
         case 0x47:
+            if (gb->gb_reg.BGP == val)
+                return;
+
+            gb->display_written = 1;
             gb->gb_reg.BGP = val;
             gb->display.bg_palette[0] = (gb->gb_reg.BGP & 0x03);
             gb->display.bg_palette[1] = (gb->gb_reg.BGP >> 2) & 0x03;
             gb->display.bg_palette[2] = (gb->gb_reg.BGP >> 4) & 0x03;
             gb->display.bg_palette[3] = (gb->gb_reg.BGP >> 6) & 0x03;
+            __gb_update_palette_lut(gb->display.palette_lut, val, true);
             return;
 
         case 0x48:
+            if (gb->gb_reg.OBP0 == val)
+                return;
+
+            gb->display_written = 1;
             gb->gb_reg.OBP0 = val;
             gb->display.sp_palette[0] = (gb->gb_reg.OBP0 & 0x03);
             gb->display.sp_palette[1] = (gb->gb_reg.OBP0 >> 2) & 0x03;
             gb->display.sp_palette[2] = (gb->gb_reg.OBP0 >> 4) & 0x03;
             gb->display.sp_palette[3] = (gb->gb_reg.OBP0 >> 6) & 0x03;
+            __gb_update_palette_lut(gb->display.palette_lut + 256, val, false);
             return;
 
         case 0x49:
+            if (gb->gb_reg.OBP1 == val)
+                return;
+
+            gb->display_written = 1;
             gb->gb_reg.OBP1 = val;
             gb->display.sp_palette[4] = (gb->gb_reg.OBP1 & 0x03);
             gb->display.sp_palette[5] = (gb->gb_reg.OBP1 >> 2) & 0x03;
             gb->display.sp_palette[6] = (gb->gb_reg.OBP1 >> 4) & 0x03;
             gb->display.sp_palette[7] = (gb->gb_reg.OBP1 >> 6) & 0x03;
+            __gb_update_palette_lut(gb->display.palette_lut + 512, val, false);
             return;
 
         /* Window Position Registers */
         case 0x4A:
+            gb->display_written |= gb->gb_reg.WY != val;
             gb->gb_reg.WY = val;
             return;
 
         case 0x4B:
+            gb->display_written |= gb->gb_reg.WX != val;
             gb->gb_reg.WX = val;
             return;
 
@@ -1584,6 +1951,7 @@ __section__(".text.pgb") static int compare_sprites(const void *in1,
 }
 #endif
 
+#if !ENABLE_BGCACHE
 __core_section("draw") static void __gb_draw_pixel(uint8_t *line, u8 x, u8 v)
 {
     u8 *pix = line + x / LCD_PACKING;
@@ -1591,459 +1959,570 @@ __core_section("draw") static void __gb_draw_pixel(uint8_t *line, u8 x, u8 v)
     *pix &= ~(((1 << LCD_BITS_PER_PIXEL) - 1) << x);
     *pix |= (v & 3) << x;
 }
+#endif
 
-__core_section("draw") static u8 __gb_get_pixel(uint8_t *line, u8 x)
+/* maps 16 background pixels, given as two bit planes, through the BGP
+ * lookup table to packed 2bpp shades */
+__attribute__((always_inline)) static inline uint32_t __gb_remap_bg(
+    const uint8_t *restrict lut, const uint32_t raw1, const uint32_t raw2)
 {
-    u8 *pix = line + x / LCD_PACKING;
-    x = (x % LCD_PACKING) * LCD_BITS_PER_PIXEL;
-    return (*pix >> x) % (1 << LCD_BITS_PER_PIXEL);
+    return lut[(raw1 & 0x0F) | ((raw2 << 4) & 0xF0)] |
+           (lut[((raw1 >> 4) & 0x0F) | (raw2 & 0xF0)] << 8) |
+           (lut[((raw1 >> 8) & 0x0F) | ((raw2 >> 4) & 0xF0)] << 16) |
+           ((uint32_t)lut[((raw1 >> 12) & 0x0F) | ((raw2 >> 8) & 0xF0)] << 24);
 }
 
-// renders one scanline
-__core_section("draw") void __gb_draw_line(struct gb_s *restrict gb)
-{
-#if ENABLE_BGCACHE_DEFERRED
-    if unlikely (gb->dirty_tile_data_master)
-        __gb_process_deferred_tile_data_update(gb);
-    if unlikely (gb->dirty_tile_rows)
-        __gb_process_deferred_tile_update(gb);
-#endif
+#define LINE_PRIORITY_LEN ((LCD_WIDTH + 31) / 32)
 
-    __builtin_prefetch(&gb->gb_reg.LCDC, 0);
-    __builtin_prefetch(&gb->gb_reg.WX, 0);
-    __builtin_prefetch(&gb->gb_reg.BGP, 0);
-    __builtin_prefetch(&gb->display.WY, 0);
+/*
+ * Scanline renderer stages. line_priority has a bit set for each pixel
+ * where the background/window is colour 0 (i.e. sprites show through);
+ * priority_bits_ carries the per-pixel renderer's state from the
+ * background to the window (unused with ENABLE_BGCACHE).
+ */
 
-    uint8_t *pixels = &gb->lcd[gb->gb_reg.LY * LCD_WIDTH_PACKED];
-    uint32_t line_priority[((LCD_WIDTH + 31) / 32)];
-    const uint32_t line_priority_len = PEANUT_GB_ARRAYSIZE(line_priority);
+/* draws the background, from the left edge up to column wx */
+__core_section("draw") static void __gb_draw_bg(
+    struct gb_s *restrict gb, uint8_t *restrict pixels,
+    uint32_t *restrict line_priority, uint32_t *priority_bits_, int wx)
+{
+    /* Calculate current background line to draw. Constant because
+     * this function draws only this one line each time it is
+     * called. */
+    const uint8_t bg_y = gb->gb_reg.LY + gb->gb_reg.SCY;
 
-    __builtin_prefetch(pixels, 1);
+#if ENABLE_BGCACHE
+    uint8_t bg_x = gb->gb_reg.SCX;
+    int addr_mode_2 = !(gb->gb_reg.LCDC & LCDC_TILE_SELECT);
+    int map2 = !!(gb->gb_reg.LCDC & LCDC_BG_MAP);
+    uint32_t *bgcache = (uint32_t *)(gb->bgcache + (bg_y * BGCACHE_STRIDE) +
+                                     addr_mode_2 * (BGCACHE_SIZE / 2) +
+                                     map2 * (BGCACHE_SIZE / 4));
+    const uint8_t *restrict lut = gb->display.palette_lut;
+    uint32_t hi = bgcache[(bg_x / 16) % 0x10];
+    for (int i = 0; i < (wx + 15) / 16; ++i)
+    {
+        uint32_t *out = (uint32_t *)(void *)(pixels) + i;
+        uint32_t lo = hi;
+        hi = bgcache[(bg_x / 16 + i + 1) % 0x10];
+        int xm = (bg_x % 16);
+        uint16_t raw1 = ((lo & 0x0000FFFF) >> xm);
+        uint16_t raw2 = ((lo & 0xFFFF0000) >> (16 + xm));
+        raw1 |= ((hi & 0x0000FFFF) << (16 - xm));
+        raw2 |= ((hi & 0xFFFF0000) >> xm);
+
+        *out = __gb_remap_bg(lut, raw1, raw2);
+
+        // calculate priority
+        uint16_t p = raw1 | raw2;
+        *((uint16_t *)line_priority + i) = p ^ 0xFFFF;
+    }
+#else
+    uint32_t priority_bits = *priority_bits_;
+
+    /* The displays (what the player sees) X coordinate, drawn right
+     * to left. */
+    uint8_t disp_x = LCD_WIDTH - 1;
+
+    /* The X coordinate to begin drawing the background at. */
+    uint8_t bg_x = disp_x + gb->gb_reg.SCX;
+
+    /* Get selected background map address for first tile
+     * corresponding to current line.
+     * 0x20 (32) is the width of a background tile, and the bit
+     * shift is to calculate the address. */
+    const uint16_t bg_map =
+        ((gb->gb_reg.LCDC & LCDC_BG_MAP) ? VRAM_BMAP_2 : VRAM_BMAP_1) +
+        (bg_y >> 3) * 0x20;
+
+    /* Get tile index for current background tile. */
+    uint8_t idx = gb->vram[bg_map + (bg_x >> 3)];
+    /* Y coordinate of tile pixel to draw. */
+    const uint8_t py = (bg_y & 0x07);
+    /* X coordinate of tile pixel to draw. */
+    uint8_t px = 7 - (bg_x & 0x07);
+
+    uint16_t tile;
+
+    /* Select addressing mode. */
+    if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
+        tile = VRAM_TILES_1 + idx * 0x10;
+    else
+        tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
 
-    for (int i = 0; i < line_priority_len; ++i)
-        line_priority[i] = 0;
+    tile += 2 * py;
 
-    uint32_t priority_bits = 0;
+    /* fetch first tile */
+    uint8_t t1 = gb->vram[tile] >> px;
+    uint8_t t2 = gb->vram[tile + 1] >> px;
 
-    int wx = LCD_WIDTH;
-    if (gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE &&
-        gb->gb_reg.LY >= gb->display.WY && gb->gb_reg.WX < LCD_WIDTH + 7)
+    for (; disp_x != 0xFF; disp_x--)
     {
-        // TODO: behaviour of wx if WX = 0-6 or WX = 166; apparently there are
-        // hardware bugs?
-        if (gb->gb_reg.WX >= 7)
+        if (px == 8)
         {
-            wx = gb->gb_reg.WX - 7;
+            /* fetch next tile */
+            px = 0;
+            bg_x = disp_x + gb->gb_reg.SCX;
+            idx = gb->vram[bg_map + (bg_x >> 3)];
+
+            if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
+                tile = VRAM_TILES_1 + idx * 0x10;
+            else
+                tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+            tile += 2 * py;
+            t1 = gb->vram[tile];
+            t2 = gb->vram[tile + 1];
         }
-        else
+
+        /* copy background */
+        uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+        __gb_draw_pixel(pixels, disp_x,
+                        gb->display.bg_palette[c] /*| LCD_PALETTE_BG*/);
+
+        t1 >>= 1;
+        t2 >>= 1;
+        px++;
+        priority_bits <<= 1;
+        priority_bits |= (c == 0);
+        if (disp_x % 32 == 0)
         {
-            // is this right? Works for link's awakening.
-            wx = 0;
+            line_priority[disp_x / 32] = priority_bits;
         }
     }
+    *priority_bits_ = priority_bits;
+#endif
+}
 
-    // clear row
-    for (int i = 0; i < LCD_WIDTH / 16; ++i)
-        ((uint32_t *)pixels)[i] = 0;
-
-#define BG_REMAP(pal, t1, t2, v)                          \
-    do                                                    \
-    {                                                     \
-        uint32_t t2_ = ((uint32_t)t2) << 1;               \
-        for (int _q = 0; _q < 16; _q++)                   \
-        {                                                 \
-            int p = ((t1 >> _q) & 1) | ((t2_ >> _q) & 2); \
-            int c = (pal >> (2 * p)) & 3;                 \
-            v >>= 2;                                      \
-            v |= c << 30;                                 \
-        }                                                 \
-    } while (0)
-
-    /* If background is enabled, draw it. */
-    if ((gb->gb_reg.LCDC & LCDC_BG_ENABLE) && wx > 0)
+/* draws the window, from column wx to the right edge */
+__core_section("draw") static void __gb_draw_window(
+    struct gb_s *restrict gb, uint8_t *restrict pixels,
+    uint32_t *restrict line_priority, uint32_t *priority_bits_, int wx)
+{
+#if ENABLE_BGCACHE
+    uint8_t bg_x =
+        256 - wx;  // CHECKME -- does window scroll? Should this be 0?
+    uint8_t bg_y = gb->gb_reg.LY - gb->display.WY;
+    int addr_mode_2 = !(gb->gb_reg.LCDC & LCDC_TILE_SELECT);
+    int map2 = !!(gb->gb_reg.LCDC & LCDC_WINDOW_MAP);
+    uint32_t *bgcache = (uint32_t *)(gb->bgcache + (bg_y * BGCACHE_STRIDE) +
+                                     addr_mode_2 * (BGCACHE_SIZE / 2) +
+                                     map2 * (BGCACHE_SIZE / 4));
+    const uint8_t *restrict lut = gb->display.palette_lut;
+    uint32_t hi = bgcache[(bg_x / 16) % 0x10];
+
+    // first part of window may be obscured
+    const int obscure_x = bg_x % 16;
+    hi &= 0xFFFF0000 | (0x0000FFFF << obscure_x);
+    hi &= 0x0000FFFF | (0xFFFF0000 << obscure_x);
+    if (obscure_x % 16 != 0)
     {
-        /* Calculate current background line to draw. Constant because
-         * this function draws only this one line each time it is
-         * called. */
-        const uint8_t bg_y = gb->gb_reg.LY + gb->gb_reg.SCY;
+        // obscure background behind window
+        ((uint16_t *)line_priority)[wx / 16] &= (0xFFFF >> obscure_x);
+        ((uint32_t *)(void *)(pixels))[wx / 16] &=
+            0xFFFFFFFF >> (2 * obscure_x);
+    }
 
-#if ENABLE_BGCACHE
-        uint8_t bg_x = gb->gb_reg.SCX;
-        int addr_mode_2 = !(gb->gb_reg.LCDC & LCDC_TILE_SELECT);
-        int map2 = !!(gb->gb_reg.LCDC & LCDC_BG_MAP);
-        uint32_t *bgcache = (uint32_t *)(gb->bgcache + (bg_y * BGCACHE_STRIDE) +
-                                         addr_mode_2 * (BGCACHE_SIZE / 2) +
-                                         map2 * (BGCACHE_SIZE / 4));
-        uint8_t pal = gb->gb_reg.BGP;
-        uint32_t hi = bgcache[(bg_x / 16) % 0x10];
-        for (int i = 0; i < (wx + 15) / 16; ++i)
-        {
-            uint32_t *out = (uint32_t *)(void *)(pixels) + i;
-            uint32_t lo = hi;
-            hi = bgcache[(bg_x / 16 + i + 1) % 0x10];
-            int xm = (bg_x % 16);
-            uint16_t raw1 = ((lo & 0x0000FFFF) >> xm);
-            uint16_t raw2 = ((lo & 0xFFFF0000) >> (16 + xm));
-            raw1 |= ((hi & 0x0000FFFF) << (16 - xm));
-            raw2 |= ((hi & 0xFFFF0000) >> xm);
-
-            uint32_t rm = 0;
-#pragma GCC unroll 16
-            BG_REMAP(pal, raw1, raw2, rm);
-            *out = rm;
-
-            // calculate priority
-            uint16_t p = raw1 | raw2;
-            *((uint16_t *)line_priority + i) = p ^ 0xFFFF;
-        }
+    for (int i = wx / 16; i < (LCD_WIDTH) / 16; ++i)
+    {
+        uint32_t *out = (uint32_t *)(void *)(pixels) + i;
+        uint32_t lo = hi;
+        hi = bgcache[(bg_x / 16 + i + 1) % 0x10];
+        int xm = (bg_x % 16);
+        uint16_t raw1 = ((lo & 0x0000FFFF) >> xm);
+        uint16_t raw2 = ((lo & 0xFFFF0000) >> (16 + xm));
+        raw1 |= ((hi & 0x0000FFFF) << (16 - xm));
+        raw2 |= ((hi & 0xFFFF0000) >> xm);
+
+        *out |= __gb_remap_bg(lut, raw1, raw2);
+
+        // calculate priority
+        uint16_t p = raw1 | raw2;
+        *((uint16_t *)line_priority + i) |= p ^ 0xFFFF;
+    }
 #else
-        /* The displays (what the player sees) X coordinate, drawn right
-         * to left. */
-        uint8_t disp_x = LCD_WIDTH - 1;
-
-        /* The X coordinate to begin drawing the background at. */
-        uint8_t bg_x = disp_x + gb->gb_reg.SCX;
-
-        /* Get selected background map address for first tile
-         * corresponding to current line.
-         * 0x20 (32) is the width of a background tile, and the bit
-         * shift is to calculate the address. */
-        const uint16_t bg_map =
-            ((gb->gb_reg.LCDC & LCDC_BG_MAP) ? VRAM_BMAP_2 : VRAM_BMAP_1) +
-            (bg_y >> 3) * 0x20;
-
-        /* Get tile index for current background tile. */
-        uint8_t idx = gb->vram[bg_map + (bg_x >> 3)];
-        /* Y coordinate of tile pixel to draw. */
-        const uint8_t py = (bg_y & 0x07);
-        /* X coordinate of tile pixel to draw. */
-        uint8_t px = 7 - (bg_x & 0x07);
-
-        uint16_t tile;
-
-        /* Select addressing mode. */
-        if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-            tile = VRAM_TILES_1 + idx * 0x10;
-        else
-            tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+    uint32_t priority_bits = *priority_bits_;
 
-        tile += 2 * py;
+    /* Calculate Window Map Address. */
+    uint16_t win_line =
+        (gb->gb_reg.LCDC & LCDC_WINDOW_MAP) ? VRAM_BMAP_2 : VRAM_BMAP_1;
+    win_line += (gb->display.window_clear >> 3) * 0x20;
 
-        /* fetch first tile */
-        uint8_t t1 = gb->vram[tile] >> px;
-        uint8_t t2 = gb->vram[tile + 1] >> px;
+    uint8_t disp_x = LCD_WIDTH - 1;
+    uint8_t win_x = disp_x - gb->gb_reg.WX + 7;
 
-        for (; disp_x != 0xFF; disp_x--)
-        {
-            if (px == 8)
-            {
-                /* fetch next tile */
-                px = 0;
-                bg_x = disp_x + gb->gb_reg.SCX;
-                idx = gb->vram[bg_map + (bg_x >> 3)];
+    // look up tile
+    uint8_t py = gb->display.window_clear & 0x07;
+    uint8_t px = 7 - (win_x & 0x07);
+    uint8_t idx = gb->vram[win_line + (win_x >> 3)];
 
-                if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-                    tile = VRAM_TILES_1 + idx * 0x10;
-                else
-                    tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+    uint16_t tile;
 
-                tile += 2 * py;
-                t1 = gb->vram[tile];
-                t2 = gb->vram[tile + 1];
-            }
+    if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
+        tile = VRAM_TILES_1 + idx * 0x10;
+    else
+        tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
 
-            /* copy background */
-            uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-            __gb_draw_pixel(pixels, disp_x,
-                            gb->display.bg_palette[c] /*| LCD_PALETTE_BG*/);
-
-            t1 >>= 1;
-            t2 >>= 1;
-            px++;
-            priority_bits <<= 1;
-            priority_bits |= (c == 0);
-            if (disp_x % 32 == 0)
-            {
-                line_priority[disp_x / 32] = priority_bits;
-            }
-        }
-#endif
-    }
+    tile += 2 * py;
 
-    /* draw window */
-    if (wx < LCD_WIDTH)
+    // fetch first tile
+    uint8_t t1 = gb->vram[tile] >> px;
+    uint8_t t2 = gb->vram[tile + 1] >> px;
+
+    // loop & copy window
+    uint8_t end = (gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7) - 1;
+
+    for (; disp_x != end; disp_x--)
     {
-#if ENABLE_BGCACHE
-        uint8_t bg_x =
-            256 - wx;  // CHECKME -- does window scroll? Should this be 0?
-        uint8_t bg_y = gb->gb_reg.LY - gb->display.WY;
-        int addr_mode_2 = !(gb->gb_reg.LCDC & LCDC_TILE_SELECT);
-        int map2 = !!(gb->gb_reg.LCDC & LCDC_WINDOW_MAP);
-        uint32_t *bgcache = (uint32_t *)(gb->bgcache + (bg_y * BGCACHE_STRIDE) +
-                                         addr_mode_2 * (BGCACHE_SIZE / 2) +
-                                         map2 * (BGCACHE_SIZE / 4));
-        uint8_t pal = gb->gb_reg.BGP;
-        uint32_t hi = bgcache[(bg_x / 16) % 0x10];
-
-        // first part of window may be obscured
-        const int obscure_x = bg_x % 16;
-        hi &= 0xFFFF0000 | (0x0000FFFF << obscure_x);
-        hi &= 0x0000FFFF | (0xFFFF0000 << obscure_x);
-        if (obscure_x % 16 != 0)
+        if (px == 8)
         {
-            // obscure background behind window
-            ((uint16_t *)line_priority)[wx / 16] &= (0xFFFF >> obscure_x);
-            ((uint32_t *)(void *)(pixels))[wx / 16] &=
-                0xFFFFFFFF >> (2 * obscure_x);
+            // fetch next tile
+            px = 0;
+            win_x = disp_x - gb->gb_reg.WX + 7;
+            idx = gb->vram[win_line + (win_x >> 3)];
+
+            if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
+                tile = VRAM_TILES_1 + idx * 0x10;
+            else
+                tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+            tile += 2 * py;
+            t1 = gb->vram[tile];
+            t2 = gb->vram[tile + 1];
         }
 
-        for (int i = wx / 16; i < (LCD_WIDTH) / 16; ++i)
+        // copy window
+        uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+        __gb_draw_pixel(pixels, disp_x,
+                        gb->display.bg_palette[c] /*| LCD_PALETTE_BG*/);
+
+        t1 >>= 1;
+        t2 >>= 1;
+        px++;
+
+        priority_bits <<= 1;
+        priority_bits |= (c == 0);
+        if (disp_x % 32 == 0)
         {
-            uint32_t *out = (uint32_t *)(void *)(pixels) + i;
-            uint32_t lo = hi;
-            hi = bgcache[(bg_x / 16 + i + 1) % 0x10];
-            int xm = (bg_x % 16);
-            uint16_t raw1 = ((lo & 0x0000FFFF) >> xm);
-            uint16_t raw2 = ((lo & 0xFFFF0000) >> (16 + xm));
-            raw1 |= ((hi & 0x0000FFFF) << (16 - xm));
-            raw2 |= ((hi & 0xFFFF0000) >> xm);
-
-            uint32_t rm = 0;
-#pragma GCC unroll 16
-            BG_REMAP(pal, raw1, raw2, rm);
-            *out |= rm;
-
-            // calculate priority
-            uint16_t p = raw1 | raw2;
-            *((uint16_t *)line_priority + i) |= p ^ 0xFFFF;
+            line_priority[disp_x / 32] = priority_bits;
         }
-#else
-        /* Calculate Window Map Address. */
-        uint16_t win_line =
-            (gb->gb_reg.LCDC & LCDC_WINDOW_MAP) ? VRAM_BMAP_2 : VRAM_BMAP_1;
-        win_line += (gb->display.window_clear >> 3) * 0x20;
+    }
 
-        uint8_t disp_x = LCD_WIDTH - 1;
-        uint8_t win_x = disp_x - gb->gb_reg.WX + 7;
+    // FIXME -- why is this guard needed..?
+    if (disp_x / 32 < LINE_PRIORITY_LEN)
+    {
+        // priority where window begins is a bit tricky
+        priority_bits <<= (disp_x % 32);
+        line_priority[disp_x / 32] &= 0xFFFFFFFF << (disp_x % 32);
+        line_priority[disp_x / 32] |= priority_bits;
+    }
 
-        // look up tile
-        uint8_t py = gb->display.window_clear & 0x07;
-        uint8_t px = 7 - (win_x & 0x07);
-        uint8_t idx = gb->vram[win_line + (win_x >> 3)];
+    gb->display.window_clear++;  // advance window line
+    *priority_bits_ = priority_bits;
+#endif
+}
 
-        uint16_t tile;
+/* Finds the lines each sprite covers, so that drawing a line need not test
+ * every sprite. Most games copy OAM once a frame, so this runs about as
+ * often, and not at all while the sprites stand still. */
+__core_section("draw") static void __gb_update_sprite_lines(
+    struct gb_s *restrict gb, const bool tall)
+{
+    uint64_t *restrict lines = gb->sprite_lines;
 
-        if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-            tile = VRAM_TILES_1 + idx * 0x10;
-        else
-            tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+    for (int ly = 0; ly < LCD_HEIGHT; ++ly)
+        lines[ly] = 0;
 
-        tile += 2 * py;
+    for (uint8_t sprite_number = 0; sprite_number < NUM_SPRITES;
+         sprite_number++)
+    {
+        /* Sprite Y position is 16 below the top line it covers. */
+        const int top = gb->oam[4 * sprite_number] - 16;
+        const int bottom = top + (tall ? 16 : 8);
 
-        // fetch first tile
-        uint8_t t1 = gb->vram[tile] >> px;
-        uint8_t t2 = gb->vram[tile + 1] >> px;
+        for (int ly = top < 0 ? 0 : top; ly < bottom && ly < LCD_HEIGHT; ++ly)
+            lines[ly] |= (uint64_t)1 << sprite_number;
+    }
 
-        // loop & copy window
-        uint8_t end = (gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7) - 1;
+    gb->sprite_lines_tall = tall;
+    gb->oam_dirty = 0;
+}
 
-        for (; disp_x != end; disp_x--)
-        {
-            if (px == 8)
-            {
-                // fetch next tile
-                px = 0;
-                win_x = disp_x - gb->gb_reg.WX + 7;
-                idx = gb->vram[win_line + (win_x >> 3)];
+/* draws the sprites; tall selects 8x16 sprites (a compile-time constant) */
+__attribute__((always_inline)) static inline void __gb_draw_sprites(
+    struct gb_s *restrict gb, uint8_t *restrict pixels,
+    const uint32_t *restrict line_priority, const bool tall)
+{
+    if unlikely (gb->oam_dirty || gb->sprite_lines_tall != tall)
+        __gb_update_sprite_lines(gb, tall);
 
-                if (gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-                    tile = VRAM_TILES_1 + idx * 0x10;
-                else
-                    tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+    /* sprites on this line, in OAM order */
+    uint64_t on_line = gb->sprite_lines[gb->gb_reg.LY];
 
-                tile += 2 * py;
-                t1 = gb->vram[tile];
-                t2 = gb->vram[tile + 1];
-            }
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+    uint8_t number_of_sprites = 0;
+    struct sprite_data sprites_to_render[NUM_SPRITES];
 
-            // copy window
-            uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-            __gb_draw_pixel(pixels, disp_x,
-                            gb->display.bg_palette[c] /*| LCD_PALETTE_BG*/);
+    /* Record number of sprites on the line being rendered, limited
+     * to the maximum number sprites that the Game Boy is able to
+     * render on each line (10 sprites). */
+    while (on_line)
+    {
+        uint8_t sprite_number = __builtin_ctzll(on_line);
+        on_line &= on_line - 1;
+
+        sprites_to_render[number_of_sprites].sprite_number = sprite_number;
+        /* Sprite X position. */
+        sprites_to_render[number_of_sprites].x =
+            gb->oam[4 * sprite_number + 1];
+        number_of_sprites++;
+    }
 
-            t1 >>= 1;
-            t2 >>= 1;
-            px++;
+    /* If maximum number of sprites reached, prioritise X
+     * coordinate and object location in OAM. */
+    qsort(&sprites_to_render[0], number_of_sprites,
+          sizeof(sprites_to_render[0]), compare_sprites);
+    if (number_of_sprites > MAX_SPRITES_LINE)
+        number_of_sprites = MAX_SPRITES_LINE;
+#endif
 
-            priority_bits <<= 1;
-            priority_bits |= (c == 0);
-            if (disp_x % 32 == 0)
-            {
-                line_priority[disp_x / 32] = priority_bits;
-            }
+    uint32_t *restrict line = (uint32_t *)(void *)pixels;
+
+    /* Render each sprite, from low priority to high priority. */
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+    /* Render the top ten prioritised sprites on this scanline. */
+    for (uint8_t sprite_number = number_of_sprites - 1;
+         sprite_number != 0xFF; sprite_number--)
+    {
+        uint8_t s_4 = sprites_to_render[sprite_number].sprite_number * 4;
+#else
+    while (on_line)
+    {
+        uint8_t sprite_number = 63 - __builtin_clzll(on_line);
+        on_line &= ~((uint64_t)1 << sprite_number);
+        uint8_t s_4 = sprite_number * 4;
+#endif
+
+        /* Sprite Y position. */
+        uint8_t OY = gb->oam[s_4];
+        /* Sprite X position. */
+        uint8_t OX = gb->oam[s_4 + 1];
+        /* Sprite Tile/Pattern Number. */
+        uint8_t OT = gb->oam[s_4 + 2] & (tall ? 0xFE : 0xFF);
+        /* Additional attributes. */
+        uint8_t OF = gb->oam[s_4 + 3];
+
+        /* Continue if sprite not visible. */
+        if (OX == 0 || OX >= 168)
+            continue;
+
+        // y flip
+        uint8_t py = gb->gb_reg.LY - OY + 16;
+
+        if (OF & OBJ_FLIP_Y)
+            py = (tall ? 15 : 7) - py;
+
+        // the 8 pixels, packed 2bpp with the leftmost in the low bits
+#if ENABLE_SPRITECACHE
+        uint32_t row =
+            gb->spritecache[(OT * 8 + py) * 2 + !!(OF & OBJ_FLIP_X)];
+#else
+        uint16_t t1_i = VRAM_TILES_1 + OT * 0x10 + 2 * py;
+        uint32_t row = __gb_sprite_row(gb->vram[t1_i], gb->vram[t1_i + 1],
+                                       OF & OBJ_FLIP_X);
+#endif
+
+        // opaque pixels (colour 0 is transparent)
+        uint32_t opaque = ((row | (row >> 1)) & 0x5555) * 3;
+
+        const uint8_t *restrict lut =
+            gb->display.palette_lut + ((OF & OBJ_PALETTE) ? 512 : 256);
+        row = lut[row & 0xFF] | (lut[row >> 8] << 8);
+
+        // clip left edge
+        int x0 = OX - 8;
+        if (x0 < 0)
+        {
+            row >>= -2 * x0;
+            opaque >>= -2 * x0;
+            x0 = 0;
         }
 
-        // FIXME -- why is this guard needed..?
-        if (disp_x / 32 < line_priority_len)
+        // behind the background: only visible where it is colour 0
+        if (OF & OBJ_PRIORITY)
         {
-            // priority where window begins is a bit tricky
-            priority_bits <<= (disp_x % 32);
-            line_priority[disp_x / 32] &= 0xFFFFFFFF << (disp_x % 32);
-            line_priority[disp_x / 32] |= priority_bits;
+            uint64_t p = line_priority[x0 / 32];
+            if (x0 / 32 + 1 < LINE_PRIORITY_LEN)
+                p |= (uint64_t)line_priority[x0 / 32 + 1] << 32;
+            opaque &= __gb_spread_bits((p >> (x0 % 32)) & 0xFF) * 3;
         }
 
-        gb->display.window_clear++;  // advance window line
-#endif
-    }
+        // merge into the line, clipping the right edge
+        const int w = x0 / 16;
+        const uint64_t r = (uint64_t)(row & opaque) << (2 * (x0 % 16));
+        const uint64_t m = (uint64_t)opaque << (2 * (x0 % 16));
 
-    // draw sprites
-    if (gb->gb_reg.LCDC & LCDC_OBJ_ENABLE)
-    {
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-        uint8_t number_of_sprites = 0;
-        struct sprite_data sprites_to_render[NUM_SPRITES];
-
-        /* Record number of sprites on the line being rendered, limited
-         * to the maximum number sprites that the Game Boy is able to
-         * render on each line (10 sprites). */
-        for (uint8_t sprite_number = 0;
-             sprite_number < PEANUT_GB_ARRAYSIZE(sprites_to_render);
-             sprite_number++)
+        line[w] = (line[w] & ~(uint32_t)m) | (uint32_t)r;
+        if (w + 1 < LCD_WIDTH / 16)
         {
-            /* Sprite Y position. */
-            uint8_t OY = gb->oam[4 * sprite_number + 0];
-            /* Sprite X position. */
-            uint8_t OX = gb->oam[4 * sprite_number + 1];
-
-            /* If sprite isn't on this line, continue. */
-            if (gb->gb_reg.LY + (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >=
-                    OY ||
-                gb->gb_reg.LY + 16 < OY)
-                continue;
-
-            sprites_to_render[number_of_sprites].sprite_number = sprite_number;
-            sprites_to_render[number_of_sprites].x = OX;
-            number_of_sprites++;
+            line[w + 1] =
+                (line[w + 1] & ~(uint32_t)(m >> 32)) | (uint32_t)(r >> 32);
         }
+    }
+}
+
+__core_section("draw") static void __gb_draw_sprites_8x8(
+    struct gb_s *restrict gb, uint8_t *restrict pixels,
+    const uint32_t *restrict line_priority)
+{
+    __gb_draw_sprites(gb, pixels, line_priority, false);
+}
 
-        /* If maximum number of sprites reached, prioritise X
-         * coordinate and object location in OAM. */
-        qsort(&sprites_to_render[0], number_of_sprites,
-              sizeof(sprites_to_render[0]), compare_sprites);
-        if (number_of_sprites > MAX_SPRITES_LINE)
-            number_of_sprites = MAX_SPRITES_LINE;
+__core_section("draw") static void __gb_draw_sprites_8x16(
+    struct gb_s *restrict gb, uint8_t *restrict pixels,
+    const uint32_t *restrict line_priority)
+{
+    __gb_draw_sprites(gb, pixels, line_priority, true);
+}
+
+/*
+ * Renders one scanline for the given layer configuration. When the
+ * arguments are compile-time constants (see GB_DRAW_LINE_VARIANT), the
+ * configuration tests are folded away.
+ */
+__attribute__((always_inline)) static inline void __gb_draw_line_cfg(
+    struct gb_s *restrict gb, const bool bg_enable, const bool window_enable,
+    const bool obj_enable, const bool obj_tall)
+{
+#if ENABLE_BGCACHE_DEFERRED
+    if unlikely (gb->dirty_tile_data_master)
+        __gb_process_deferred_tile_data_update(gb);
+    if unlikely (gb->dirty_tile_rows)
+        __gb_process_deferred_tile_update(gb);
 #endif
 
-        const uint16_t OBP = gb->gb_reg.OBP0 | ((uint16_t)gb->gb_reg.OBP1 << 8);
+    __builtin_prefetch(&gb->gb_reg.WX, 0);
+    __builtin_prefetch(&gb->gb_reg.BGP, 0);
+    __builtin_prefetch(&gb->display.WY, 0);
+
+    uint8_t *pixels = &gb->lcd[gb->gb_reg.LY * LCD_WIDTH_PACKED];
+    uint32_t line_priority[LINE_PRIORITY_LEN];
 
-        /* Render each sprite, from low priority to high priority. */
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-        /* Render the top ten prioritised sprites on this scanline. */
-        for (uint8_t sprite_number = number_of_sprites - 1;
-             sprite_number != 0xFF; sprite_number--)
+    __builtin_prefetch(pixels, 1);
+
+    for (int i = 0; i < LINE_PRIORITY_LEN; ++i)
+        line_priority[i] = 0;
+
+    uint32_t priority_bits = 0;
+
+    int wx = LCD_WIDTH;
+    if (window_enable && gb->gb_reg.LY >= gb->display.WY &&
+        gb->gb_reg.WX < LCD_WIDTH + 7)
+    {
+        // TODO: behaviour of wx if WX = 0-6 or WX = 166; apparently there are
+        // hardware bugs?
+        if (gb->gb_reg.WX >= 7)
         {
-            uint8_t s = sprites_to_render[sprite_number].sprite_number;
-#else
-        for (uint8_t sprite_number = NUM_SPRITES - 1; sprite_number != 0xFF;
-             sprite_number--)
+            wx = gb->gb_reg.WX - 7;
+        }
+        else
         {
-#endif
-            uint8_t s_4 = sprite_number * 4;
-
-            /* Sprite Y position. */
-            uint8_t OY = gb->oam[s_4];
-            /* Sprite X position. */
-            uint8_t OX = gb->oam[s_4 + 1];
-            /* Sprite Tile/Pattern Number. */
-            uint8_t OT = gb->oam[s_4 + 2] &
-                         (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0xFE : 0xFF);
-            /* Additional attributes. */
-            uint8_t OF = gb->oam[s_4 + 3];
-
-#if !PEANUT_GB_HIGH_LCD_ACCURACY
-            /* If sprite isn't on this line, continue. */
-            if (gb->gb_reg.LY + (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >=
-                    OY ||
-                gb->gb_reg.LY + 16 < OY)
-                continue;
-#endif
-
-            /* Continue if sprite not visible. */
-            if (OX == 0 || OX >= 168)
-                continue;
+            // is this right? Works for link's awakening.
+            wx = 0;
+        }
+    }
 
-            // y flip
-            uint8_t py = gb->gb_reg.LY - OY + 16;
+    // clear row
+    for (int i = 0; i < LCD_WIDTH / 16; ++i)
+        ((uint32_t *)pixels)[i] = 0;
 
-            if (OF & OBJ_FLIP_Y)
-                py = (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 15 : 7) - py;
+    /* If background is enabled, draw it. */
+    if (bg_enable && wx > 0)
+        __gb_draw_bg(gb, pixels, line_priority, &priority_bits, wx);
 
-            uint16_t t1_i = VRAM_TILES_1 + OT * 0x10 + 2 * py;
+    /* draw window */
+    if (window_enable && wx < LCD_WIDTH)
+        __gb_draw_window(gb, pixels, line_priority, &priority_bits, wx);
 
-            // fetch the tile
-            uint8_t t1 = gb->vram[t1_i];
-            uint8_t t2 = gb->vram[t1_i + 1];
+    // draw sprites
+    if (obj_enable)
+    {
+        if (obj_tall)
+            __gb_draw_sprites_8x16(gb, pixels, line_priority);
+        else
+            __gb_draw_sprites_8x8(gb, pixels, line_priority);
+    }
 
-            // handle x flip
-            uint8_t dir, start, end, shift;
+    if (gb->display.lcd_draw_line)
+        gb->display.lcd_draw_line(gb, pixels, gb->gb_reg.LY);
+}
 
-            if (OF & OBJ_FLIP_X)
-            {
-                dir = 1;
-                start = (OX < 8 ? 0 : OX - 8);
-                end = MIN(OX, LCD_WIDTH);
-                shift = 8 - OX + start;
-            }
-            else
-            {
-                dir = -1;
-                start = MIN(OX, LCD_WIDTH) - 1;
-                end = (OX < 8 ? 0 : OX - 8) - 1;
-                shift = OX - (start + 1);
-            }
+// renders one scanline, for any LCDC configuration
+__core_section("draw") void __gb_draw_line(struct gb_s *restrict gb)
+{
+    const uint8_t LCDC = gb->gb_reg.LCDC;
+    __gb_draw_line_cfg(gb, LCDC & LCDC_BG_ENABLE, LCDC & LCDC_WINDOW_ENABLE,
+                       LCDC & LCDC_OBJ_ENABLE, LCDC & LCDC_OBJ_SIZE);
+}
 
-            // copy tile
-            t1 >>= shift;
-            t2 >>= shift;
+#define GB_DRAW_LINE_VARIANT(section, name, bg, window, obj, tall) \
+    section static void name(struct gb_s *restrict gb)              \
+    {                                                               \
+        __gb_draw_line_cfg(gb, bg, window, obj, tall);              \
+    }
 
-            uint8_t c_add = (OF & OBJ_PALETTE) ? 8 : 0;
+// specialised scanline renderers for the most common LCDC configurations.
+// Only those with objects enabled, as in gameplay, are copied to ITCM; the
+// ones without are mostly seen on still title and menu screens, and stay in
+// flash so as not to grow the relocated core.
+GB_DRAW_LINE_VARIANT(__core_section("draw"), __gb_draw_line_bo, 1, 0, 1, 0)
+GB_DRAW_LINE_VARIANT(__core_section("draw"), __gb_draw_line_bt, 1, 0, 1, 1)
+GB_DRAW_LINE_VARIANT(__core_section("draw"), __gb_draw_line_bwo, 1, 1, 1, 0)
+GB_DRAW_LINE_VARIANT(__core_section("draw"), __gb_draw_line_bwt, 1, 1, 1, 1)
+GB_DRAW_LINE_VARIANT(__section__(".text.pgb"), __gb_draw_line_b, 1, 0, 0, 0)
+GB_DRAW_LINE_VARIANT(__section__(".text.pgb"), __gb_draw_line_bw, 1, 1, 0, 0)
+
+/*
+ * Chooses the scanline renderer for the current LCDC; must be called
+ * whenever LCDC changes.
+ */
+static void __gb_select_draw_line(struct gb_s *gb)
+{
+    void (*draw_line)(struct gb_s *restrict gb);
+    uint8_t LCDC = gb->gb_reg.LCDC;
 
-            for (uint8_t disp_x = start; disp_x != end; disp_x += dir)
-            {
-                uint8_t c = ((t1 & 0x1) << 1) | ((t2 & 0x1) << 2);
-                // check transparency / sprite overlap / background overlap
-                if (c != 0)  // Sprite palette index 0 is transparent
-                {
-                    int P_segment_index = disp_x / 32;
-                    int P_bit_in_segment = disp_x % 32;
-
-                    uint8_t background_pixel_is_transparent = 0;
-                    if (P_segment_index >= 0 &&
-                        P_segment_index < line_priority_len)
-                    {
-                        background_pixel_is_transparent =
-                            (line_priority[P_segment_index] >>
-                             P_bit_in_segment) &
-                            1;
-                    }
-
-                    bool sprite_has_behind_bg_attr = (OF & OBJ_PRIORITY);
-                    bool should_hide_sprite_pixel =
-                        sprite_has_behind_bg_attr &&
-                        !background_pixel_is_transparent;
-
-                    if (!should_hide_sprite_pixel)
-                    {
-                        __gb_draw_pixel(pixels, disp_x,
-                                        (OBP >> (c | c_add)) & 3);
-                    }
-                }
+    // object size is irrelevant when objects are disabled
+    if (!(LCDC & LCDC_OBJ_ENABLE))
+        LCDC &= ~LCDC_OBJ_SIZE;
 
-                t1 >>= 1;
-                t2 >>= 1;
-            }
-        }
+    switch (LCDC & (LCDC_BG_ENABLE | LCDC_WINDOW_ENABLE | LCDC_OBJ_ENABLE |
+                    LCDC_OBJ_SIZE))
+    {
+    case LCDC_BG_ENABLE:
+        draw_line = __gb_draw_line_b;
+        break;
+    case LCDC_BG_ENABLE | LCDC_OBJ_ENABLE:
+        draw_line = ITCM_CORE_FN(__gb_draw_line_bo);
+        break;
+    case LCDC_BG_ENABLE | LCDC_OBJ_ENABLE | LCDC_OBJ_SIZE:
+        draw_line = ITCM_CORE_FN(__gb_draw_line_bt);
+        break;
+    case LCDC_BG_ENABLE | LCDC_WINDOW_ENABLE:
+        draw_line = __gb_draw_line_bw;
+        break;
+    case LCDC_BG_ENABLE | LCDC_WINDOW_ENABLE | LCDC_OBJ_ENABLE:
+        draw_line = ITCM_CORE_FN(__gb_draw_line_bwo);
+        break;
+    case LCDC_BG_ENABLE | LCDC_WINDOW_ENABLE | LCDC_OBJ_ENABLE |
+        LCDC_OBJ_SIZE:
+        draw_line = ITCM_CORE_FN(__gb_draw_line_bwt);
+        break;
+    default:
+        draw_line = ITCM_CORE_FN(__gb_draw_line);
+        break;
     }
+
+    gb->display.draw_line = draw_line;
 }
 #endif
 
@@ -4864,6 +5343,7 @@ __core void __gb_step_cpu(struct gb_s *gb)
     if unlikely (gb->gb_halt)
     {
         inst_cycles = __gb_calc_halt_cycles(gb);
+        gb->halt_cycles += inst_cycles;
         goto done_instr;
     }
 
@@ -5105,6 +5585,9 @@ done_instr:
         uint16_t LY_1 = gb->gb_reg.LY + 1;
         gb->gb_reg.LY = (LY_1 >= LCD_VERT_LINES) ? LY_1 - LCD_VERT_LINES : LY_1;
 
+        if (gb->gb_reg.LY == gb->joypad_sample_line)
+            __gb_sample_joypad(gb);
+
         /* VBLANK Start */
         if (gb->gb_reg.LY == LCD_HEIGHT)
         {
@@ -5163,7 +5646,7 @@ done_instr:
 #if ENABLE_LCD
         if (gb->lcd_master_enable && !gb->lcd_blank &&
             !(gb->direct.frame_skip && !gb->display.frame_skip_count))
-            __gb_draw_line(gb);
+            gb->display.draw_line(gb);
 #endif
     }
 }
@@ -5172,6 +5655,9 @@ done_instr:
 __core void gb_run_frame(struct gb_s *gb)
 {
     gb->gb_frame = 0;
+    gb->joypad_sampled = 0;
+    gb->display_written = 0;
+    gb->halt_cycles = 0;
 
     /*
     // paranoid extra tile update
@@ -5215,6 +5701,20 @@ void gb_init_serial(struct gb_s *gb,
     gb->gb_serial_rx = gb_serial_rx;
 }
 
+/**
+ * Set the function used to re-sample the buttons during a frame, for lower
+ * input latency. This is optional.
+ * gb_joypad_sample updates gb->direct.joypad. It is called at most once per
+ * frame: when LY reaches sample_line, or, with JOYPAD_SAMPLE_ON_P1, the
+ * first time the game writes P1 to poll the joypad.
+ */
+void gb_init_joypad(struct gb_s *gb, void (*gb_joypad_sample)(struct gb_s *),
+                    uint8_t sample_line)
+{
+    gb->gb_joypad_sample = gb_joypad_sample;
+    gb->joypad_sample_line = sample_line;
+}
+
 uint8_t gb_colour_hash(struct gb_s *gb)
 {
 #define ROM_TITLE_START_ADDR 0x0134
@@ -5236,6 +5736,7 @@ __section__(".rare") void gb_reset(struct gb_s *gb)
     gb->gb_halt = 0;
     gb->gb_ime = 1;
     gb->gb_bios_enable = 0;
+    gb->oam_dirty = 1;
     gb->lcd_mode = LCD_HBLANK;
 
     /* Initialise MBC values. */
@@ -5269,6 +5770,9 @@ __section__(".rare") void gb_reset(struct gb_s *gb)
     gb->gb_reg.IF = 0xE1;
 
     gb->gb_reg.LCDC = 0x91;
+#if ENABLE_LCD
+    __gb_select_draw_line(gb);
+#endif
     gb->gb_reg.SCY = 0x00;
     gb->gb_reg.SCX = 0x00;
     gb->gb_reg.LYC = 0x00;
@@ -5278,6 +5782,11 @@ __section__(".rare") void gb_reset(struct gb_s *gb)
     gb->gb_reg.STAT = 0;
     gb->gb_reg.LY = 0;
 
+    /* differ from the values written below, so that the palette lookup
+     * tables are built */
+    gb->gb_reg.BGP = 0x03;
+    gb->gb_reg.OBP0 = 0x00;
+    gb->gb_reg.OBP1 = 0xF0;
     __gb_write(gb, 0xFF47, 0xFC);  // BGP
     __gb_write(gb, 0xFF48, 0xFF);  // OBJP0
     __gb_write(gb, 0xFF49, 0x0F);  // OBJP1
@@ -5290,6 +5799,9 @@ __section__(".rare") void gb_reset(struct gb_s *gb)
 
     memset(gb->vram, 0x00, VRAM_SIZE);
     memset(gb->wram, 0x00, WRAM_SIZE);
+#if ENABLE_SPRITECACHE
+    memset(gb->spritecache, 0x00, SPRITECACHE_SIZE * sizeof(uint16_t));
+#endif
 }
 
 /**
@@ -5352,6 +5864,14 @@ __section__(".rare") enum gb_init_error_e
     memset(bgcache, 0, sizeof(bgcache));
     gb->bgcache = bgcache;
 #endif
+#if ENABLE_SPRITECACHE
+    static clalign uint16_t spritecache[SPRITECACHE_SIZE];
+    gb->spritecache = spritecache;
+#endif
+    static clalign uint64_t sprite_lines[LCD_HEIGHT];
+    gb->sprite_lines = sprite_lines;
+    static clalign uint8_t palette_lut[3 * 256];
+    gb->display.palette_lut = palette_lut;
     gb->lcd = lcd;
     gb->gb_rom = gb_rom;
     gb->gb_error = gb_error;
@@ -5365,6 +5885,8 @@ __section__(".rare") enum gb_init_error_e
      * automatically. */
     gb->gb_serial_tx = NULL;
     gb->gb_serial_rx = NULL;
+    gb->gb_joypad_sample = NULL;
+    gb->gb_rtc_now = NULL;
 
     /* Check valid ROM using checksum value. */
     {
@@ -5520,8 +6042,18 @@ static __section__(".rare") int __gb_try_breakpoint(struct gb_s *gb)
 
 #if ENABLE_LCD
 
-void gb_init_lcd(struct gb_s *gb)
+/**
+ * Initialise LCD state.
+ *
+ * \param lcd_draw_line  optional function called with each line as soon as
+ *                       it has been rendered into gb->lcd; may be NULL.
+ */
+void gb_init_lcd(struct gb_s *gb,
+                 void (*lcd_draw_line)(struct gb_s *gb, const uint8_t *pixels,
+                                       const uint_fast8_t line))
 {
+    gb->display.lcd_draw_line = lcd_draw_line;
+
     gb->direct.frame_skip = 0;
     gb->display.frame_skip_count = 0;
 
@@ -5536,7 +6068,9 @@ void gb_init_lcd(struct gb_s *gb)
 
 #else
 
-void gb_init_lcd(struct gb_s *gb)
+void gb_init_lcd(struct gb_s *gb,
+                 void (*lcd_draw_line)(struct gb_s *gb, const uint8_t *pixels,
+                                       const uint_fast8_t line))
 {
 }
 
@@ -0,0 +1,145 @@
+#include "audio_record.h"
+
+#include <string.h>
+
+#include "../minigb_apu/minigb_apu.h"
+#include "utility.h"
+
+#define WAV_HEADER_SIZE 44
+
+static SDFile *record_file;
+static uint32_t record_frames;     // frames to record
+static uint32_t record_frame;      // frames recorded so far
+static uint32_t record_samples;    // stereo samples written so far
+static uint32_t record_hash;       // FNV-1a of the samples written
+static float record_render_time;   // seconds spent in audio_render
+static bool record_audio_enabled;  // audio enabled before recording
+
+static void put_le(uint8_t *p, uint32_t v, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        p[i] = v >> (8 * i);
+}
+
+// 16-bit stereo PCM at AUDIO_OUTPUT_RATE
+static bool write_wav_header(uint32_t samples)
+{
+    uint8_t h[WAV_HEADER_SIZE];
+    const uint32_t data_size = samples * 4;
+
+    memcpy(h, "RIFF", 4);
+    put_le(h + 4, WAV_HEADER_SIZE - 8 + data_size, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le(h + 16, 16, 4);
+    put_le(h + 20, 1, 2);
+    put_le(h + 22, 2, 2);
+    put_le(h + 24, AUDIO_OUTPUT_RATE, 4);
+    put_le(h + 28, AUDIO_OUTPUT_RATE * 4, 4);
+    put_le(h + 32, 4, 2);
+    put_le(h + 34, 16, 2);
+    memcpy(h + 36, "data", 4);
+    put_le(h + 40, data_size, 4);
+
+    return playdate->file->write(record_file, h, sizeof(h)) == sizeof(h);
+}
+
+bool audio_record_start(const char *path, uint32_t frames)
+{
+    if (record_file || frames == 0)
+        return false;
+
+    record_file = playdate->file->open(path, kFileWrite);
+    if (!record_file)
+    {
+        playdate->system->logToConsole("Audio recording: cannot open %s: %s",
+                                       path, playdate->file->geterr());
+        return false;
+    }
+
+    if (!write_wav_header(0))
+    {
+        playdate->system->logToConsole("Audio recording: cannot write %s",
+                                       path);
+        playdate->file->close(record_file);
+        record_file = NULL;
+        return false;
+    }
+
+    record_frames = frames;
+    record_frame = 0;
+    record_samples = 0;
+    record_hash = AUDIO_RECORD_HASH_INIT;
+    record_render_time = 0;
+
+    // take the channels over from audio_callback, and start from a clock
+    // that does not depend on where it left off
+    record_audio_enabled = audio_suspend();
+    audio_render_reset();
+
+    playdate->system->logToConsole("Audio recording: %u frames to %s",
+                                   (unsigned)frames, path);
+    return true;
+}
+
+void audio_record_frame(void)
+{
+    static int16_t left[AUDIO_RECORD_BLOCK], right[AUDIO_RECORD_BLOCK];
+    static int16_t out[AUDIO_RECORD_BLOCK * 2];
+
+    if (!record_file)
+        return;
+
+    const uint32_t end = audio_record_frame_end(record_frame);
+
+    while (record_samples < end)
+    {
+        const int n = PGB_MIN(AUDIO_RECORD_BLOCK, end - record_samples);
+
+        memset(left, 0, n * sizeof(left[0]));
+        memset(right, 0, n * sizeof(right[0]));
+
+        const float start = playdate->system->getElapsedTime();
+        audio_render(left, right, n);
+        record_render_time += playdate->system->getElapsedTime() - start;
+
+        for (int i = 0; i < n; ++i)
+        {
+            out[i * 2] = left[i];
+            out[i * 2 + 1] = right[i];
+        }
+
+        record_hash = audio_record_hash(record_hash, out, n * 4);
+
+        if (playdate->file->write(record_file, out, n * 4) != n * 4)
+        {
+            playdate->system->logToConsole("Audio recording: write failed: %s",
+                                           playdate->file->geterr());
+            audio_record_stop();
+            return;
+        }
+        record_samples += n;
+    }
+
+    if (++record_frame == record_frames)
+        audio_record_stop();
+}
+
+void audio_record_stop(void)
+{
+    if (!record_file)
+        return;
+
+    playdate->file->seek(record_file, 0, SEEK_SET);
+    write_wav_header(record_samples);
+    playdate->file->close(record_file);
+    record_file = NULL;
+
+    audio_resume(record_audio_enabled);
+
+    playdate->system->logToConsole(
+        "Audio recording: %u frames, %u samples, fingerprint %08x, "
+        "%.1f us rendering per frame",
+        (unsigned)record_frame, (unsigned)record_samples,
+        (unsigned)record_hash,
+        record_frame ? (double)record_render_time * 1e6 / record_frame : 0.0);
+}
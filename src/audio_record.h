@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../minigb_apu/minigb_apu.h"
+
+// Offline rendering of the emulated sound to a WAV file, for comparing the
+// APU's output and its cost between builds. While recording, the audio
+// thread is silenced and each emulated frame's sound is rendered on the
+// main thread at exactly the nominal rate, so the file depends only on
+// what the game did and not on timing.
+
+// starts recording the next frames emulated frames to path; false if a
+// recording is already running or the file cannot be created
+bool audio_record_start(const char *path, uint32_t frames);
+
+// renders and writes the frame just emulated, after audio_end_frame()
+void audio_record_frame(void);
+
+// finishes the recording, early if need be, and logs its fingerprint;
+// does nothing if not recording
+void audio_record_stop(void);
+
+// The schedule and fingerprint of a recording, shared with the host-side
+// runner in tools/ so that their fingerprints compare.
+
+#define AUDIO_RECORD_BLOCK 256  // samples rendered at a time
+#define AUDIO_RECORD_HASH_INIT 2166136261u
+
+// total samples by the end of the given frame (from 0), at the Game Boy's
+// frame rate
+static inline uint32_t audio_record_frame_end(uint32_t frame)
+{
+    return (uint64_t)(frame + 1) * AUDIO_OUTPUT_RATE *
+           (uint32_t)SCREEN_REFRESH_CYCLES / (uint32_t)DMG_CLOCK_FREQ;
+}
+
+// FNV-1a over the interleaved 16-bit samples, as written to the file
+static inline uint32_t audio_record_hash(uint32_t hash, const void *data,
+                                         uint32_t size)
+{
+    const uint8_t *bytes = data;
+    for (uint32_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
@@ -0,0 +1,361 @@
+//
+//  dither.c
+//  CrankBoy
+//
+//  Maintained and developed by the CrankBoy dev team.
+//
+
+#include "dither.h"
+
+#include "../peanut_gb/peanut_gb.h"
+#include "app.h"
+
+static const uint16_t PGB_dither_lut_c0 =
+    0 | (0b1111 << 0) | (0b0111 << 4) | (0b0001 << 8) | (0b0000 << 12);
+
+static const uint16_t PGB_dither_lut_c1 =
+    0 | (0b1111 << 0) | (0b1101 << 4) | (0b0100 << 8) | (0b0000 << 12);
+
+// threshold tiles (0-63, 8 columns wide); a pixel is white if its
+// threshold is below the level of its colour.
+static const uint8_t PGB_dither_levels[4] = {64, 48, 16, 0};
+
+static const uint8_t PGB_dither_bayer[4][8] = {
+    {0, 32, 8, 40, 0, 32, 8, 40},
+    {48, 16, 56, 24, 48, 16, 56, 24},
+    {12, 44, 4, 36, 12, 44, 4, 36},
+    {60, 28, 52, 20, 60, 28, 52, 20},
+};
+
+// void-and-cluster, toroidal
+static const uint8_t PGB_dither_blue_noise[8][8] = {
+    {16, 45, 29, 57, 7, 53, 22, 6},  {26, 51, 0, 35, 13, 44, 30, 56},
+    {10, 61, 17, 42, 25, 63, 2, 40}, {36, 31, 21, 58, 5, 34, 19, 52},
+    {4, 48, 8, 38, 50, 11, 46, 15},  {28, 54, 43, 14, 27, 55, 24, 60},
+    {33, 20, 3, 62, 32, 1, 41, 9},   {59, 12, 39, 23, 47, 18, 37, 49},
+};
+
+typedef struct
+{
+    // NULL: the c0/c1 pattern, picked per line by the 5:3 layout's phase.
+    const uint8_t (*thresholds)[8];
+    uint8_t rows;   // tile height, power of two
+    bool temporal;  // odd frames use the complementary tile
+} PGB_DitherEngine;
+
+static const PGB_DitherEngine PGB_dither_engines[PGB_DitherModeCount] = {
+    [PGB_DitherModePattern] = {NULL, 2, false},
+    [PGB_DitherModeBayer] = {PGB_dither_bayer, 4, false},
+    [PGB_DitherModeBlueNoise] = {PGB_dither_blue_noise, 8, false},
+    [PGB_DitherModeTemporal] = {PGB_dither_bayer, 4, true},
+};
+
+#define PGB_DITHER_TABLE_ROWS 8
+
+// packed gameboy byte (4 pixels) -> dithered framebuffer byte (8 pixels),
+// for each row of the current engine's tile.
+static uint8_t PGB_dither_table[PGB_DITHER_TABLE_ROWS][256];
+
+// as above, but 4 pixels wide (1:1 scale mode; [row][byte % 2]), and 10
+// pixels wide (stretch mode; [row][byte % 4]), since those bytes start at
+// different columns of the tile.
+static uint8_t PGB_dither_table_1x[PGB_DITHER_TABLE_ROWS][2][256];
+static uint16_t PGB_dither_table_stretch[PGB_DITHER_TABLE_ROWS][4][256];
+
+static int PGB_dither_table_mode = -1;
+
+// row selection for the blitters: 0 selects rows by the layout's phase,
+// otherwise by playdate row (& mask) plus the temporal offset.
+static uint8_t PGB_dither_row_mask;
+uint8_t PGB_dither_temporal_rows;
+uint8_t PGB_dither_row_offset;
+
+// Playdate rows covered by gameboy line y_gb in the 5:3 layout: groups of
+// three lines, from the bottom up, with heights 2, 2, 1, where the dither
+// pattern swaps at every height-1 line (yields smoother results).
+__core_section("fb") static unsigned gb_line_pd_top(unsigned y_gb,
+                                                    unsigned *height,
+                                                    unsigned *phase)
+{
+    unsigned r = (LCD_HEIGHT - 1) - y_gb;
+    unsigned k = r % 3;
+
+    *height = (k == 2) ? 1 : 2;
+    *phase = ((r + 1) / 3) & 1;
+    return PGB_LCD_Y + PGB_LCD_HEIGHT - 5 * (r / 3) - (k == 0 ? 2 : 3 + k);
+}
+
+// dither table rows for the playdate rows top and top + 1.
+__core_section("fb") static inline void dither_rows(unsigned top,
+                                                    unsigned phase,
+                                                    unsigned *row0,
+                                                    unsigned *row1)
+{
+    unsigned mask = PGB_dither_row_mask;
+
+    if (mask == 0)
+    {
+        *row0 = phase;
+        *row1 = phase ^ 1;
+    }
+    else
+    {
+        *row0 = (top & mask) | PGB_dither_row_offset;
+        *row1 = ((top + 1) & mask) | PGB_dither_row_offset;
+    }
+}
+
+// dithers one gameboy line (2x horizontally) into one or two playdate rows,
+// using dither table rows row0 and row1 respectively.
+__core_section("fb") static void blit_gb_line(uint8_t *restrict pd_row,
+                                              const uint8_t *restrict gb_line,
+                                              unsigned row0, unsigned row1,
+                                              int row_height)
+{
+    const uint8_t *restrict t0 = PGB_dither_table[row0];
+    const uint8_t *restrict t1 = PGB_dither_table[row1];
+    const uint32_t *restrict src = (const uint32_t *)(const void *)gb_line;
+    uint32_t *restrict dst0 = (uint32_t *)(void *)pd_row;
+    uint32_t *restrict dst1 =
+        (uint32_t *)(void *)(pd_row + PLAYDATE_ROW_STRIDE);
+
+    // 4 packed gameboy bytes -> 4 framebuffer bytes per row
+    for (int i = 0; i < LCD_WIDTH_PACKED / 4; ++i)
+    {
+        uint32_t px = src[i];
+        dst0[i] = t0[px & 0xFF] | (t0[(px >> 8) & 0xFF] << 8) |
+                  (t0[(px >> 16) & 0xFF] << 16) | ((uint32_t)t0[px >> 24] << 24);
+
+        if (row_height == 2)
+        {
+            dst1[i] = t1[px & 0xFF] | (t1[(px >> 8) & 0xFF] << 8) |
+                      (t1[(px >> 16) & 0xFF] << 16) |
+                      ((uint32_t)t1[px >> 24] << 24);
+        }
+    }
+}
+
+// 1:1, one row per line; 4 packed gameboy bytes -> 2 framebuffer bytes.
+__core_section("fb") static void blit_gb_line_1x(
+    uint8_t *restrict pd_row, const uint8_t *restrict gb_line, unsigned row)
+{
+    const uint8_t *restrict t0 = PGB_dither_table_1x[row][0];
+    const uint8_t *restrict t1 = PGB_dither_table_1x[row][1];
+    const uint32_t *restrict src = (const uint32_t *)(const void *)gb_line;
+
+    // (PGB_LCD_1X_X is not 16-aligned, so store bytewise)
+    for (int i = 0; i < LCD_WIDTH_PACKED / 4; ++i)
+    {
+        uint32_t px = src[i];
+        pd_row[2 * i] = (t0[px & 0xFF] << 4) | t1[(px >> 8) & 0xFF];
+        pd_row[2 * i + 1] = (t0[(px >> 16) & 0xFF] << 4) | t1[px >> 24];
+    }
+}
+
+// 2.5x horizontally (pixel widths 3, 2, 3, 2, ...) across the full 400
+// columns; 4 packed gameboy bytes -> 5 framebuffer bytes.
+__core_section("fb") static void blit_gb_line_stretch(
+    uint8_t *restrict pd_row, const uint8_t *restrict gb_line, unsigned row)
+{
+    const uint16_t(*restrict t)[256] = PGB_dither_table_stretch[row];
+    const uint32_t *restrict src = (const uint32_t *)(const void *)gb_line;
+
+    for (int i = 0; i < LCD_WIDTH_PACKED / 4; ++i)
+    {
+        uint32_t px = src[i];
+        uint64_t bits = ((uint64_t)t[0][px & 0xFF] << 30) |
+                        ((uint64_t)t[1][(px >> 8) & 0xFF] << 20) |
+                        (t[2][(px >> 16) & 0xFF] << 10) | t[3][px >> 24];
+        pd_row[0] = bits >> 32;
+        pd_row[1] = bits >> 24;
+        pd_row[2] = bits >> 16;
+        pd_row[3] = bits >> 8;
+        pd_row[4] = bits;
+        pd_row += 5;
+    }
+}
+
+// draws gameboy line y_gb to the framebuffer in the given scale mode.
+// Returns the first playdate row written, and the number of rows in *height
+// (0 if the line is not visible).
+__core_section("fb") unsigned blit_line(uint8_t *restrict framebuffer,
+                                        const uint8_t *restrict gb_line,
+                                        unsigned y_gb,
+                                        PGB_ScaleMode scale_mode,
+                                        unsigned pan, unsigned *height)
+{
+    unsigned top, phase, row0, row1;
+
+    switch (scale_mode)
+    {
+    case PGB_ScaleMode1x:
+        *height = 1;
+        top = PGB_LCD_1X_Y + y_gb;
+        dither_rows(top, y_gb & 1, &row0, &row1);
+        blit_gb_line_1x(
+            framebuffer + (PGB_LCD_1X_X / 8) + top * PLAYDATE_ROW_STRIDE,
+            gb_line, row0);
+        return top;
+
+    case PGB_ScaleMode2x:
+        if (y_gb < pan || y_gb >= pan + PGB_LCD_HEIGHT / 2)
+        {
+            *height = 0;
+            return 0;
+        }
+        *height = 2;
+        top = PGB_LCD_Y + (y_gb - pan) * 2;
+        dither_rows(top, 0, &row0, &row1);
+        blit_gb_line(
+            framebuffer + (PGB_LCD_X / 8) + top * PLAYDATE_ROW_STRIDE,
+            gb_line, row0, row1, 2);
+        return top;
+
+    case PGB_ScaleModeStretch:
+        top = gb_line_pd_top(y_gb, height, &phase);
+        dither_rows(top, phase, &row0, &row1);
+        blit_gb_line_stretch(framebuffer + top * PLAYDATE_ROW_STRIDE, gb_line,
+                             row0);
+        if (*height == 2)
+        {
+            blit_gb_line_stretch(
+                framebuffer + (top + 1) * PLAYDATE_ROW_STRIDE, gb_line, row1);
+        }
+        return top;
+
+    case PGB_ScaleModeFit:
+    default:
+        top = gb_line_pd_top(y_gb, height, &phase);
+        dither_rows(top, phase, &row0, &row1);
+        blit_gb_line(
+            framebuffer + (PGB_LCD_X / 8) + top * PLAYDATE_ROW_STRIDE,
+            gb_line, row0, row1, *height);
+        return top;
+    }
+}
+
+__core_section("fb") void update_fb_dirty_lines(
+    uint8_t *restrict framebuffer, uint8_t *restrict lcd,
+    const uint16_t *restrict line_changed_flags, PGB_RowMarker *marker,
+    PGB_ScaleMode scale_mode, unsigned pan)
+{
+    for (int y_gb = LCD_HEIGHT;
+         y_gb-- > 0;)  // y_gb is Game Boy line index from top, 143 down to 0
+    {
+        if (((line_changed_flags[y_gb / 16] >> (y_gb % 16)) & 1) == 0)
+        {
+            continue;  // Skip drawing
+        }
+
+        unsigned height;
+        unsigned top = blit_line(framebuffer, &lcd[y_gb * LCD_WIDTH_PACKED],
+                                 y_gb, scale_mode, pan, &height);
+
+        row_marker_add(marker, top, height);
+    }
+
+    row_marker_flush(marker);
+}
+
+// dithers 4 packed gameboy pixels, each widths[i] playdate pixels wide and
+// starting at playdate column col, to a bit string (leftmost pixel in the
+// highest bit). masks[colour] has bit (col % 8) set where the tile row is
+// white.
+static unsigned dither_pixels(const uint8_t masks[4],
+                                           unsigned pixels,
+                                           const uint8_t widths[4],
+                                           unsigned col)
+{
+    unsigned p = 0;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        unsigned colour = (pixels >> (2 * i)) & 3;
+
+        for (int w = 0; w < widths[i]; ++w, ++col)
+        {
+            p <<= 1;
+            p |= (masks[colour] >> (col % 8)) & 1;
+        }
+    }
+
+    return p;
+}
+
+// (re)builds the dither tables for the given dithering engine.
+void PGB_Dither_updateTables(PGB_DitherMode mode)
+{
+    static const uint8_t widths_2x[4] = {2, 2, 2, 2};
+    static const uint8_t widths_1x[4] = {1, 1, 1, 1};
+    static const uint8_t widths_stretch[4] = {3, 2, 3, 2};
+    static const uint8_t pattern_bit[4] = {1, 0, 3, 2};
+
+    const PGB_DitherEngine *engine = &PGB_dither_engines[mode];
+    unsigned rows = engine->rows * (engine->temporal ? 2 : 1);
+
+    PGB_ASSERT(rows <= PGB_DITHER_TABLE_ROWS);
+
+    PGB_dither_row_mask = engine->thresholds ? engine->rows - 1 : 0;
+    PGB_dither_temporal_rows = engine->temporal ? engine->rows : 0;
+    PGB_dither_row_offset = 0;
+
+    if (PGB_dither_table_mode == (int)mode)
+    {
+        return;
+    }
+
+    PGB_dither_table_mode = mode;
+
+    for (unsigned row = 0; row < rows; row++)
+    {
+        uint8_t masks[4] = {0};
+
+        for (int colour = 0; colour < 4; colour++)
+        {
+            for (int col = 0; col < 8; col++)
+            {
+                bool white;
+
+                if (engine->thresholds == NULL)
+                {
+                    uint16_t lut = (row & 1) ? PGB_dither_lut_c1
+                                             : PGB_dither_lut_c0;
+                    white = (lut >> (colour * 4 + pattern_bit[col % 4])) & 1;
+                }
+                else if (row < engine->rows)
+                {
+                    white = engine->thresholds[row][col] <
+                            PGB_dither_levels[colour];
+                }
+                else
+                {
+                    // complementary tile, so that every pixel of a grey
+                    // alternates between frames
+                    white = (63 - engine->thresholds[row - engine->rows][col]) <
+                            PGB_dither_levels[colour];
+                }
+
+                masks[colour] |= white << col;
+            }
+        }
+
+        for (int pixels = 0; pixels < 256; pixels++)
+        {
+            PGB_dither_table[row][pixels] =
+                dither_pixels(masks, pixels, widths_2x, 0);
+
+            for (int b = 0; b < 2; b++)
+            {
+                PGB_dither_table_1x[row][b][pixels] =
+                    dither_pixels(masks, pixels, widths_1x, 4 * b);
+            }
+
+            for (int b = 0; b < 4; b++)
+            {
+                PGB_dither_table_stretch[row][b][pixels] =
+                    dither_pixels(masks, pixels, widths_stretch,
+                                               10 * b);
+            }
+        }
+    }
+}
@@ -0,0 +1,105 @@
+//
+//  dither.h
+//  CrankBoy
+//
+//  Maintained and developed by the CrankBoy dev team.
+//
+
+#ifndef dither_h
+#define dither_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utility.h"
+
+// how the gameboy screen is laid out on the playdate display
+typedef enum
+{
+    PGB_ScaleModeFit,      // 2x horizontally, 5:3 vertically (320x240)
+    PGB_ScaleMode1x,       // 1:1, centred (160x144)
+    PGB_ScaleMode2x,       // 2x both ways (320x240), crank pans vertically
+    PGB_ScaleModeStretch,  // 2.5x horizontally, 5:3 vertically (400x240)
+    PGB_ScaleModeCount
+} PGB_ScaleMode;
+
+// how grey levels are dithered to black and white
+typedef enum
+{
+    PGB_DitherModePattern,    // fixed 4x2 pattern
+    PGB_DitherModeBayer,      // 4x4 ordered
+    PGB_DitherModeBlueNoise,  // 8x8 blue-noise tile
+    PGB_DitherModeTemporal,   // 4x4 ordered, complemented on odd frames
+    PGB_DitherModeCount
+} PGB_DitherMode;
+
+typedef typeof(playdate->graphics->markUpdatedRows) markUpdateRows_t;
+
+// Merges the display rows to mark as updated into contiguous runs, so that
+// markUpdateRows is called once per run rather than once per line.
+typedef struct
+{
+    markUpdateRows_t markUpdateRows;
+    int top, height;  // pending run
+    uint16_t calls, rows;
+} PGB_RowMarker;
+
+__attribute__((always_inline)) static inline void row_marker_flush(
+    PGB_RowMarker *marker)
+{
+    if (marker->height > 0)
+    {
+        marker->markUpdateRows(marker->top,
+                               marker->top + marker->height - 1);
+        marker->calls++;
+        marker->rows += marker->height;
+        marker->height = 0;
+    }
+}
+
+__attribute__((always_inline)) static inline void row_marker_add(
+    PGB_RowMarker *marker, int top, int height)
+{
+    if (height <= 0)
+        return;
+
+    const int end = top + height;
+    const int run_end = marker->top + marker->height;
+    if (marker->height > 0 && top <= run_end && end >= marker->top)
+    {
+        // adjacent to or overlapping the pending run
+        marker->top = PGB_MIN(marker->top, top);
+        marker->height = (end > run_end ? end : run_end) - marker->top;
+        return;
+    }
+
+    row_marker_flush(marker);
+    marker->top = top;
+    marker->height = height;
+}
+
+// (re)builds the dither tables for the given dithering engine.
+void PGB_Dither_updateTables(PGB_DitherMode mode);
+
+// dither table rows of a temporal engine's complementary tile (0 for other
+// engines), and the offset the blitters add to every row: set it to one or
+// the other on alternate frames.
+extern uint8_t PGB_dither_temporal_rows;
+extern uint8_t PGB_dither_row_offset;
+
+// draws gameboy line y_gb to the framebuffer in the given scale mode.
+// Returns the first playdate row written, and the number of rows in *height
+// (0 if the line is not visible).
+unsigned blit_line(uint8_t *restrict framebuffer,
+                   const uint8_t *restrict gb_line, unsigned y_gb,
+                   PGB_ScaleMode scale_mode, unsigned pan, unsigned *height);
+
+// draws the gameboy lines flagged in line_changed_flags, and marks the
+// playdate rows they cover as updated.
+void update_fb_dirty_lines(uint8_t *restrict framebuffer,
+                           uint8_t *restrict lcd,
+                           const uint16_t *restrict line_changed_flags,
+                           PGB_RowMarker *marker, PGB_ScaleMode scale_mode,
+                           unsigned pan);
+
+#endif /* dither_h */
@@ -11,6 +11,7 @@
 #include "../minigb_apu/minigb_apu.h"
 #include "../peanut_gb/peanut_gb.h"
 #include "app.h"
+#include "audio_record.h"
 #include "dtcm.h"
 #include "preferences.h"
 #include "revcheck.h"
@@ -25,9 +26,14 @@
 // attempt to stay on top of frames per second
 #define DYNAMIC_RATE_ADJUSTMENT 1
 
-// TODO: double-check these
+// dither each line into the framebuffer as soon as the PPU has drawn it,
+// rather than in a separate pass over the whole LCD after the frame.
+#ifndef DIRECT_LINE_OUTPUT
+#define DIRECT_LINE_OUTPUT 0
+#endif
 
-// approximately how long it takes to render one gameboy line
+// initial estimate of how long it takes to render one gameboy line;
+// the actual cost is measured as the game runs (see PGB_FramePacing)
 #define LINE_RENDER_TIME_S 0.000032f
 
 // expected extra time outside of logic + rendering
@@ -36,6 +42,43 @@
 // let's try to render a frame at least this fast
 #define TARGET_RENDER_TIME_S 0.0167f
 
+// weight of each new measurement in the frame pacing moving averages
+#define PACING_EWMA_WEIGHT 0.125f
+
+// a changed line is never held back for more than this many frames
+#define PACING_MAX_LINE_AGE 4
+
+// score of a held-back line per frame it has waited, against the score
+// of 1 per changed pixel
+#define PACING_AGE_WEIGHT 32
+
+// a frame is idle if the CPU was halted for most of it and nothing that
+// affects the picture was written
+#define IDLE_MIN_HALT_CYCLES ((uint32_t)(SCREEN_REFRESH_CYCLES * 7 / 8))
+
+// idle frames in a row before the picture can no longer change; this
+// covers a write late in the frame before, frame skip and frame blending
+#define IDLE_SETTLE_FRAMES 3
+
+// with audio pacing, the emulated time queued ahead of the audio callback is
+// kept between these at the start of each update; the band is two frames
+// wide so that callback and update jitter do not make every other update
+// run one frame fewer or more
+#define AUDIO_PACING_FILL_LOW ((int32_t)SCREEN_REFRESH_CYCLES / 2)
+#define AUDIO_PACING_FILL_HIGH (5 * (int32_t)SCREEN_REFRESH_CYCLES / 2)
+
+// in 2x mode the crank pans the view over this far either side of upright,
+// and Start/Select need turning to the larger angle, well past the end of
+// the pan, so that panning never presses them
+#define SCALE_PAN_ANGLE 90.0f
+#define SCALE_PAN_TRIGGER_ANGLE 135.0f
+
+// bytes of RTC state after cartridge RAM in the save file
+#define RTC_TRAILER_SIZE 48
+
+// getSecondsSinceEpoch() counts from 2000-01-01
+#define PLAYDATE_EPOCH_UNIX 946684800
+
 PGB_GameScene *audioGameScene = NULL;
 
 static void PGB_GameScene_selector_init(PGB_GameScene *gameScene);
@@ -49,24 +92,32 @@ static void PGB_GameScene_event(void *object, PDSystemEvent event,
 static uint8_t *read_rom_to_ram(const char *filename,
                                 PGB_GameSceneError *sceneError);
 
-static void read_cart_ram_file(const char *save_filename, uint8_t **dest,
-                               const size_t len);
-static void write_cart_ram_file(const char *save_filename, uint8_t *src,
-                                const size_t len);
+static size_t read_cart_ram_file(const char *save_filename, uint8_t **dest,
+                                 const size_t len, uint8_t *rtc_trailer);
+static void write_cart_ram_file(const char *save_filename, struct gb_s *gb);
+static uint32_t gb_rtc_now(struct gb_s *gb);
+static uint64_t rtc_now_unix(void);
+static bool rtc_trailer_unpack(const uint8_t *in, size_t len, uint8_t regs[5],
+                               uint32_t *seconds_ago);
 
 static void gb_error(struct gb_s *gb, const enum gb_error_e gb_err,
                      const uint16_t val);
 static void gb_save_to_disk(struct gb_s *gb);
+#if DIRECT_LINE_OUTPUT
+void gb_draw_line_direct(struct gb_s *gb, const uint8_t *pixels,
+                         const uint_fast8_t y_gb);
+#endif
+
+static PDMenuItem *scaleModeMenuItem;
+static const char *scaleModeOptions[PGB_ScaleModeCount] = {"fit", "1x", "2x",
+                                                           "stretch"};
+static PDMenuItem *ditherModeMenuItem;
+static const char *ditherModeOptions[PGB_DitherModeCount] = {
+    "pattern", "bayer", "noise", "temporal"};
 
 static const char *startButtonText = "start";
 static const char *selectButtonText = "select";
 
-static const uint16_t PGB_dither_lut_c0 =
-    0 | (0b1111 << 0) | (0b0111 << 4) | (0b0001 << 8) | (0b0000 << 12);
-
-static const uint16_t PGB_dither_lut_c1 =
-    0 | (0b1111 << 0) | (0b1101 << 4) | (0b0100 << 8) | (0b0000 << 12);
-
 static uint8_t PGB_bitmask[4][4][4];
 static bool PGB_GameScene_bitmask_done = false;
 
@@ -127,10 +178,6 @@ PGB_GameScene *PGB_GameScene_new(const char *rom_filename)
 
     scene->preferredRefreshRate = 30;
 
-    gameScene->rtc_time = playdate->system->getSecondsSinceEpoch(NULL);
-    gameScene->rtc_seconds_to_catch_up = 0;
-    gameScene->rtc_fractional_second_accumulator = 0.0f;
-
     gameScene->rom_filename = string_copy(rom_filename);
     gameScene->save_filename = NULL;
 
@@ -148,9 +195,21 @@ PGB_GameScene *PGB_GameScene_new(const char *rom_filename)
 
     gameScene->staticSelectorUIDrawn = false;
 
+    gameScene->scale_mode = preferences_scale_mode < PGB_ScaleModeCount
+                                ? preferences_scale_mode
+                                : PGB_ScaleModeFit;
+    gameScene->scale_pan = 0;
+    gameScene->dither_mode = preferences_dither_mode < PGB_DitherModeCount
+                                 ? preferences_dither_mode
+                                 : PGB_DitherModePattern;
+    gameScene->frame_blend = PGB_FrameBlendOff;
+    gameScene->idle_slowdown = false;
+    gameScene->audio_pacing = false;
+
     gameScene->save_data_loaded_successfully = false;
 
     PGB_GameScene_generateBitmask();
+    PGB_Dither_updateTables(gameScene->dither_mode);
 
     PGB_GameScene_selector_init(gameScene);
 
@@ -218,8 +277,10 @@ PGB_GameScene *PGB_GameScene_new(const char *rom_filename)
             char *save_filename = pgb_save_filename(rom_filename, false);
             gameScene->save_filename = save_filename;
 
-            read_cart_ram_file(save_filename, &context->cart_ram,
-                               gb_get_save_size(context->gb));
+            uint8_t rtc_trailer[RTC_TRAILER_SIZE];
+            size_t rtc_trailer_len =
+                read_cart_ram_file(save_filename, &context->cart_ram,
+                                   gb_get_save_size(context->gb), rtc_trailer);
 
             gameScene->save_data_loaded_successfully = true;
 
@@ -234,25 +295,31 @@ PGB_GameScene *PGB_GameScene_new(const char *rom_filename)
                     "Cartridge Type 0x%02X: RTC Enabled.",
                     actual_cartridge_type);
 
-                // Initialize Playdate-side RTC tracking variables
-                gameScene->rtc_time =
-                    playdate->system->getSecondsSinceEpoch(NULL);
-                gameScene->rtc_seconds_to_catch_up = 0;
-                gameScene->rtc_fractional_second_accumulator = 0.0f;
-
-                // Set the GB core's RTC
-                time_t time_for_core =
-                    gameScene->rtc_time + 946684800;  // Unix epoch
-                struct tm *timeinfo = localtime(&time_for_core);
-                if (timeinfo != NULL)
-                {
-                    gb_set_rtc(context->gb, timeinfo);
-                }
-                else
+                uint8_t regs[5];
+                uint32_t seconds_ago = 0;
+                if (!rtc_trailer_unpack(rtc_trailer, rtc_trailer_len, regs,
+                                        &seconds_ago))
                 {
-                    playdate->system->logToConsole(
-                        "Error: localtime() failed during RTC setup.");
+                    // No saved clock; start from local time.
+                    time_t now = rtc_now_unix();
+                    struct tm *timeinfo = localtime(&now);
+                    memset(regs, 0, sizeof(regs));
+                    if (timeinfo != NULL)
+                    {
+                        regs[0] = timeinfo->tm_sec;
+                        regs[1] = timeinfo->tm_min;
+                        regs[2] = timeinfo->tm_hour;
+                        regs[3] = timeinfo->tm_yday & 0xFF;
+                        regs[4] = timeinfo->tm_yday >> 8;
+                    }
+                    else
+                    {
+                        playdate->system->logToConsole(
+                            "Error: localtime() failed during RTC setup.");
+                    }
                 }
+
+                gb_init_rtc(context->gb, gb_rtc_now, regs, seconds_ago);
             }
             else
             {
@@ -262,6 +329,12 @@ PGB_GameScene *PGB_GameScene_new(const char *rom_filename)
                     actual_cartridge_type, context->gb->mbc);
             }
 
+            audio_set_quality(preferences_sound_quality
+                                  ? AUDIO_QUALITY_BLEP
+                                  : AUDIO_QUALITY_FAST);
+            audio_set_sample_rate(preferences_sound_rate);
+            audio_set_gain(AUDIO_GAIN_UNITY);
+            audio_set_paced(gameScene->audio_pacing);
             audio_init(gb->hram + 0x10);
             if (gameScene->audioEnabled)
             {
@@ -274,12 +347,25 @@ PGB_GameScene *PGB_GameScene_new(const char *rom_filename)
             }
 
             // init lcd
-            gb_init_lcd(context->gb);
+#if DIRECT_LINE_OUTPUT
+            context->direct_fb = NULL;
+            gb_init_lcd(context->gb, ITCM_CORE_FN(gb_draw_line_direct));
+#else
+            gb_init_lcd(context->gb, NULL);
+#endif
 
             // Initialize previous_lcd, for simplicity, let's zero it.
             // This means the first frame will draw everything.
             memset(context->previous_lcd, 0, sizeof(context->previous_lcd));
 
+            memset(&context->pacing, 0, sizeof(context->pacing));
+            context->pacing.line_time_s = LINE_RENDER_TIME_S;
+
+            context->idle_frames = 0;
+            context->idle_slow = false;
+            context->idle_buttons = 0;
+            context->lcd_presented = false;
+
             context->gb->direct.frame_skip = preferences_frame_skip ? 1 : 0;
 
             // set game state to loaded
@@ -433,19 +519,82 @@ static uint8_t *read_rom_to_ram(const char *filename,
     return rom;
 }
 
-static void read_cart_ram_file(const char *save_filename, uint8_t **dest,
-                               const size_t len)
+/* The RTC's clock source: seconds since 2000-01-01. */
+static uint32_t gb_rtc_now(struct gb_s *gb)
+{
+    return playdate->system->getSecondsSinceEpoch(NULL);
+}
+
+static uint64_t rtc_now_unix(void)
+{
+    return (uint64_t)playdate->system->getSecondsSinceEpoch(NULL) +
+           PLAYDATE_EPOCH_UNIX;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *p)
 {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-    /* If save file not required. */
-    if (len == 0)
+/*
+ * The RTC trailer follows cartridge RAM in the save file, in the layout
+ * used by BGB and VBA-M: the live sec/min/hour/day low/day high registers
+ * and then the latched ones, each as a little-endian 32-bit word, then the
+ * UNIX time at which they were saved (64-bit, or 32-bit in older files).
+ */
+static void rtc_trailer_pack(struct gb_s *gb, uint8_t out[RTC_TRAILER_SIZE])
+{
+    uint8_t regs[5];
+    gb_get_rtc(gb, regs);
+
+    for (int i = 0; i < 5; ++i)
     {
-        *dest = NULL;
-        return;
+        put_le32(out + i * 4, regs[i]);
+        put_le32(out + 20 + i * 4, gb->cart_rtc[i]);
     }
 
+    uint64_t now = rtc_now_unix();
+    put_le32(out + 40, (uint32_t)now);
+    put_le32(out + 44, (uint32_t)(now >> 32));
+}
+
+/* Returns false if there is no usable trailer. */
+static bool rtc_trailer_unpack(const uint8_t *in, size_t len, uint8_t regs[5],
+                               uint32_t *seconds_ago)
+{
+    if (len != RTC_TRAILER_SIZE && len != RTC_TRAILER_SIZE - 4)
+        return false;
+
+    for (int i = 0; i < 5; ++i)
+        regs[i] = get_le32(in + i * 4);
+
+    uint64_t saved = get_le32(in + 40);
+    if (len == RTC_TRAILER_SIZE)
+        saved |= (uint64_t)get_le32(in + 44) << 32;
+
+    uint64_t now = rtc_now_unix();
+    uint64_t gap = (now > saved) ? now - saved : 0;
+    *seconds_ago = (gap > UINT32_MAX) ? UINT32_MAX : (uint32_t)gap;
+
+    return true;
+}
+
+/* Returns the length of the RTC trailer read, if any. */
+static size_t read_cart_ram_file(const char *save_filename, uint8_t **dest,
+                                 const size_t len, uint8_t *rtc_trailer)
+{
+    *dest = NULL;
+
     /* Allocate enough memory to hold save file. */
-    if ((*dest = pgb_malloc(len)) == NULL)
+    if (len > 0 && (*dest = pgb_malloc(len)) == NULL)
     {
         playdate->system->logToConsole("%s:%i: Error allocating save file %s",
                                        __FILE__, __LINE__, save_filename);
@@ -457,19 +606,28 @@ static void read_cart_ram_file(const char *save_filename, uint8_t **dest,
      * save memory allocated above. The save file will be created on exit. */
     if (f == NULL)
     {
-        memset(*dest, 0, len);
-        return;
+        if (*dest)
+            memset(*dest, 0, len);
+        return 0;
     }
 
     /* Read save file to allocated memory. */
-    playdate->file->read(f, *dest, (unsigned int)len);
+    if (*dest)
+        playdate->file->read(f, *dest, (unsigned int)len);
+
+    int rtc_len = playdate->file->read(f, rtc_trailer, RTC_TRAILER_SIZE);
     playdate->file->close(f);
+
+    return (rtc_len > 0) ? (size_t)rtc_len : 0;
 }
 
-static void write_cart_ram_file(const char *save_filename, uint8_t *src,
-                                const size_t len)
+static void write_cart_ram_file(const char *save_filename, struct gb_s *gb)
 {
-    if (len == 0 || src == NULL)
+    uint8_t *src = gb->gb_cart_ram;
+    size_t len = gb_get_save_size(gb);
+    bool has_rtc = gb->gb_rtc_now != NULL;
+
+    if ((len == 0 || src == NULL) && !has_rtc)
     {
         return;
     }
@@ -486,7 +644,16 @@ static void write_cart_ram_file(const char *save_filename, uint8_t *src,
     }
 
     /* Record save file. */
-    playdate->file->write(f, src, (unsigned int)(len * sizeof(uint8_t)));
+    if (len > 0 && src != NULL)
+        playdate->file->write(f, src, (unsigned int)(len * sizeof(uint8_t)));
+
+    if (has_rtc)
+    {
+        uint8_t rtc_trailer[RTC_TRAILER_SIZE];
+        rtc_trailer_pack(gb, rtc_trailer);
+        playdate->file->write(f, rtc_trailer, RTC_TRAILER_SIZE);
+    }
+
     playdate->file->close(f);
 }
 
@@ -502,8 +669,7 @@ static void gb_save_to_disk(struct gb_s *gb)
 
     if (gameScene->save_filename)
     {
-        write_cart_ram_file(gameScene->save_filename, context->gb->gb_cart_ram,
-                            gb_get_save_size(context->gb));
+        write_cart_ram_file(gameScene->save_filename, context->gb);
     }
     else
     {
@@ -557,8 +723,7 @@ static void gb_error(struct gb_s *gb, const enum gb_error_e gb_err,
         {
             char *recovery_filename =
                 pgb_save_filename(context->scene->rom_filename, true);
-            write_cart_ram_file(recovery_filename, context->gb->gb_cart_ram,
-                                gb_get_save_size(context->gb));
+            write_cart_ram_file(recovery_filename, context->gb);
             pgb_free(recovery_filename);
         }
 
@@ -573,104 +738,285 @@ static void gb_error(struct gb_s *gb, const enum gb_error_e gb_err,
     return;
 }
 
-typedef typeof(playdate->graphics->markUpdatedRows) markUpdateRows_t;
+// shade-wise max of two packed 2bpp words (16 pixels each).
+__core_section("fb") static inline uint32_t gb_blend_max(uint32_t a,
+                                                         uint32_t b)
+{
+    const uint32_t hi = 0xAAAAAAAA;
+
+    // per pixel, a > b: high bit greater, or high bits equal and low bit
+    // greater. Computed in the high bit, then spread to the low bit.
+    uint32_t gt = (a & ~b & hi) | (~(a ^ b) & hi & ((a & ~b) << 1));
+    uint32_t mask = gt | (gt >> 1);
+
+    return (a & mask) | (b & ~mask);
+}
 
-__core_section("fb") void update_fb_dirty_lines(
-    uint8_t *restrict framebuffer, uint8_t *restrict lcd,
-    const uint16_t *restrict line_changed_flags,
-    markUpdateRows_t markUpdateRows)
+// shade-wise average of two packed 2bpp words, rounded up.
+__core_section("fb") static inline uint32_t gb_blend_average(uint32_t a,
+                                                             uint32_t b)
 {
-    framebuffer += (PGB_LCD_X / 8);
-    // const u32 dither = 0b00011111 | (0b00001011 << 8);
-    int scale_index = 0;
-    unsigned fb_y_playdate_current_bottom =
-        PGB_LCD_Y + PGB_LCD_HEIGHT;  // Bottom of drawable area on Playdate
+    const uint32_t hi = 0xAAAAAAAA;
 
-    uint32_t dither_lut =
-        PGB_dither_lut_c0 | ((uint32_t)PGB_dither_lut_c1 << 16);
+    return (a | b) - (((a ^ b) & hi) >> 1);
+}
 
-    for (int y_gb = LCD_HEIGHT;
-         y_gb-- > 0;)  // y_gb is Game Boy line index from top, 143 down to 0
+// blends one line of the current frame with the previous frame's into out,
+// then replaces the previous frame's line with the current one.
+__core_section("fb") static void gb_blend_line(uint32_t *restrict out,
+                                               const uint32_t *restrict cur,
+                                               uint32_t *restrict last,
+                                               PGB_FrameBlend frame_blend)
+{
+    if (frame_blend == PGB_FrameBlendMax)
     {
-        int row_height_on_playdate = 2;
-        if (scale_index++ == 2)
+        for (int i = 0; i < LCD_WIDTH_PACKED / 4; ++i)
         {
-            scale_index = 0;
-            row_height_on_playdate = 1;
-
-            // swap dither pattern on each half-row;
-            // yields smoother results
-            dither_lut = (dither_lut >> 16) | (dither_lut << 16);
+            uint32_t px = cur[i];
+            out[i] = gb_blend_max(px, last[i]);
+            last[i] = px;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < LCD_WIDTH_PACKED / 4; ++i)
+        {
+            uint32_t px = cur[i];
+            out[i] = gb_blend_average(px, last[i]);
+            last[i] = px;
         }
+    }
+}
+
+__core_section("fb") void gb_blend_frame(uint8_t *restrict out,
+                                         const uint8_t *restrict cur,
+                                         uint8_t *restrict last,
+                                         PGB_FrameBlend frame_blend)
+{
+    for (int y = 0; y < LCD_HEIGHT; ++y)
+    {
+        unsigned i = y * LCD_WIDTH_PACKED;
+        gb_blend_line((uint32_t *)(void *)&out[i],
+                      (const uint32_t *)(const void *)&cur[i],
+                      (uint32_t *)(void *)&last[i], frame_blend);
+    }
+}
+
+#if DIRECT_LINE_OUTPUT
+// invoked by the PPU for each line as soon as it is rendered.
+__core_section("fb") void gb_draw_line_direct(struct gb_s *gb,
+                                              const uint8_t *pixels,
+                                              const uint_fast8_t y_gb)
+{
+    PGB_GameSceneContext *context = gb->direct.priv;
+    PGB_GameScene *gameScene = context->scene;
+    uint8_t *framebuffer = context->direct_fb;
+
+    // not inside PGB_GameScene_update's frame (e.g. stepped from a script)
+    if (framebuffer == NULL)
+        return;
+
+    uint32_t *restrict prev =
+        (uint32_t *)(void *)&context->previous_lcd[y_gb * LCD_WIDTH_PACKED];
+    const uint32_t *restrict cur = (const uint32_t *)(const void *)pixels;
+
+    uint32_t blended[LCD_WIDTH_PACKED / 4];
+    if (gameScene->frame_blend != PGB_FrameBlendOff)
+    {
+        gb_blend_line(
+            blended, cur,
+            (uint32_t *)(void *)&context
+                ->blend_last_lcd[y_gb * LCD_WIDTH_PACKED],
+            gameScene->frame_blend);
+        cur = blended;
+    }
+
+    if (!context->direct_fb_force)
+    {
+        // under temporal dithering, a line holding shade 1 or 2 changes
+        // with the phase
+        const uint32_t grey_mask = PGB_dither_temporal_rows ? 0x55555555 : 0;
+        uint32_t diff = 0;
+        for (int i = 0; i < LCD_WIDTH_PACKED / 4; ++i)
+            diff |= (prev[i] ^ cur[i]) | ((cur[i] ^ (cur[i] >> 1)) & grey_mask);
+        if (diff == 0)
+            return;
+    }
+
+    for (int i = 0; i < LCD_WIDTH_PACKED / 4; ++i)
+        prev[i] = cur[i];
+
+    unsigned height;
+    context->direct_line_top[y_gb] =
+        blit_line(framebuffer, (const uint8_t *)cur, y_gb,
+                  gameScene->scale_mode, gameScene->scale_pan, &height);
+    context->direct_line_height[y_gb] = height;
+
+    context->direct_line_changed[y_gb / 16] |= 1 << (y_gb % 16);
+}
+#endif
+
+static void save_check(struct gb_s *gb);
+
+// maps the Playdate's buttons onto the Game Boy's; start and select come
+// from the crank selector, and are left as they are.
+static void gb_joypad_from_buttons(struct gb_s *gb, PDButtons buttons)
+{
+    gb->direct.joypad_bits.a = !(buttons & kButtonA);
+    gb->direct.joypad_bits.b = !(buttons & kButtonB);
+    gb->direct.joypad_bits.left = !(buttons & kButtonLeft);
+    gb->direct.joypad_bits.up = !(buttons & kButtonUp);
+    gb->direct.joypad_bits.right = !(buttons & kButtonRight);
+    gb->direct.joypad_bits.down = !(buttons & kButtonDown);
+}
+
+// re-samples the buttons during a frame (see gb_init_joypad)
+static void gb_joypad_sample(struct gb_s *gb)
+{
+    PDButtons buttons;
+    playdate->system->getButtonState(&buttons, NULL, NULL);
+    gb_joypad_from_buttons(gb, buttons);
+}
+
+#if DYNAMIC_RATE_ADJUSTMENT
+// Chooses which changed lines to push this frame, from how long emulation
+// took and the measured cost of a line. When not all of them fit, lines
+// are scored by how many pixels changed plus how long they have waited,
+// and the best-scoring ones are pushed; a line that has waited
+// PACING_MAX_LINE_AGE frames is pushed regardless. Lines held back are
+// cleared from line_has_changed; they still differ from previous_lcd, so
+// they come back on a later frame. Returns how many lines were held back.
+__section__(".text.tick") static int PGB_GameScene_paceLines(
+    PGB_FramePacing *pacing, float logic_time,
+    uint16_t line_has_changed[LCD_HEIGHT / 16],
+    const uint8_t line_diff[LCD_HEIGHT])
+{
+    pacing->logic_time_s +=
+        (logic_time - pacing->logic_time_s) * PACING_EWMA_WEIGHT;
 
-        // Calculate the Playdate Y position for the *top* of the current GB
-        // line's representation
-        unsigned int current_line_pd_top_y =
-            fb_y_playdate_current_bottom - row_height_on_playdate;
+    int line_changed_count = 0;
+    for (int i = 0; i < LCD_HEIGHT / 16; i++)
+    {
+        line_changed_count += __builtin_popcount(line_has_changed[i]);
+    }
+
+    float time_for_rendering =
+        TARGET_RENDER_TIME_S - LINE_RENDER_MARGIN_S - logic_time;
+    int budget = 0;
+    if (time_for_rendering > 0)
+    {
+        budget = MIN(LCD_HEIGHT, time_for_rendering / pacing->line_time_s);
+    }
+
+    if (budget >= line_changed_count)
+    {
+        memset(pacing->line_age, 0, sizeof(pacing->line_age));
+        pacing->frames_full++;
+        pacing->lines_pushed += line_changed_count;
+        return 0;
+    }
+
+    // score each changed line; overdue lines are pushed regardless, and
+    // the rest compete for what remains of the budget
+    uint8_t score[LCD_HEIGHT];
+    uint8_t score_count[256];
+    memset(score_count, 0, sizeof(score_count));
+    for (int y = 0; y < LCD_HEIGHT; y++)
+    {
+        if (!((line_has_changed[y / 16] >> (y % 16)) & 1))
+        {
+            pacing->line_age[y] = 0;
+            continue;
+        }
 
-        if (((line_changed_flags[y_gb / 16] >> (y_gb % 16)) & 1) == 0)
+        if (pacing->line_age[y] >= PACING_MAX_LINE_AGE)
         {
-            // If line not changed, just update the bottom for the next line
-            fb_y_playdate_current_bottom -= row_height_on_playdate;
-            continue;  // Skip drawing
+            budget--;
+            pacing->lines_forced++;
+            continue;
         }
 
-        // Line has changed, draw it
-        fb_y_playdate_current_bottom -=
-            row_height_on_playdate;  // Update bottom for this drawn line
+        score[y] = MIN(255, line_diff[y] +
+                                pacing->line_age[y] * PACING_AGE_WEIGHT);
+        score_count[score[y]]++;
+    }
 
-        uint8_t *restrict gb_line_data = &lcd[y_gb * LCD_WIDTH_PACKED];
-        uint8_t *restrict pd_fb_line_top_ptr =
-            &framebuffer[current_line_pd_top_y * PLAYDATE_ROW_STRIDE];
+    // find the lowest score that still fits, and how many lines with
+    // exactly that score fit
+    int threshold = 256;
+    int take_at_threshold = 0;
+    while (threshold > 0 && budget > 0)
+    {
+        threshold--;
+        take_at_threshold = MIN(budget, score_count[threshold]);
+        budget -= take_at_threshold;
+    }
 
-        for (int x_packed_gb = LCD_WIDTH_PACKED; x_packed_gb-- > 0;)
+    int lines_pushed = 0;
+    for (int y = 0; y < LCD_HEIGHT; y++)
+    {
+        const uint16_t bit = 1 << (y % 16);
+        if (!(line_has_changed[y / 16] & bit))
+            continue;
+
+        bool push = pacing->line_age[y] >= PACING_MAX_LINE_AGE ||
+                    score[y] > threshold ||
+                    (score[y] == threshold && take_at_threshold-- > 0);
+        if (push)
         {
-            uint8_t orgpixels = gb_line_data[x_packed_gb];
-            uint8_t pixels_temp_c0 = orgpixels;
-            unsigned p = 0;
-
-#pragma GCC unroll 4
-            for (int i = 0; i < 4; ++i)
-            {  // Unpack 4 GB pixels from the byte
-                p <<= 2;
-                unsigned c0h = dither_lut >> ((pixels_temp_c0 & 3) * 4);
-                unsigned c0 = (c0h >> ((i * 2) % 4)) & 3;
-                p |= c0;
-                pixels_temp_c0 >>= 2;
-            }
+            pacing->line_age[y] = 0;
+            lines_pushed++;
+        }
+        else
+        {
+            pacing->line_age[y]++;
+            line_has_changed[y / 16] &= ~bit;
+        }
+    }
 
-            u8 *restrict pd_fb_target_byte0 = pd_fb_line_top_ptr + x_packed_gb;
-            *pd_fb_target_byte0 = p & 0xFF;
+    if (lines_pushed == 0)
+        pacing->frames_skipped++;
+    else
+        pacing->frames_partial++;
+    pacing->lines_pushed += lines_pushed;
+    pacing->lines_deferred += line_changed_count - lines_pushed;
+    return line_changed_count - lines_pushed;
+}
 
-            if (row_height_on_playdate == 2)
-            {
-                uint8_t pixels_temp_c1 =
-                    orgpixels;  // Reset for second dither pattern
-                u8 *restrict pd_fb_target_byte1 =
-                    pd_fb_target_byte0 +
-                    PLAYDATE_ROW_STRIDE;  // Next Playdate row
-                p = 0;  // Reset p for the second row calculation
-
-// FIXME: why does this pragma cause a crash if unroll 4??
-#pragma GCC unroll 2
-                for (int i = 0; i < 4; ++i)
-                {
-                    p <<= 2;
-                    unsigned c1h =
-                        dither_lut >> ((pixels_temp_c1 & 3) * 4 + 16);
-                    unsigned c1 = (c1h >> ((i * 2) % 4)) & 3;
-                    p |= c1;
-                    pixels_temp_c1 >>= 2;
-                }
-                *pd_fb_target_byte1 = p & 0xFF;
-            }
-        }
-        markUpdateRows(current_line_pd_top_y,
-                       current_line_pd_top_y + row_height_on_playdate - 1);
+// folds the measured cost of pushing line_count lines into the average
+__section__(".text.tick") static void PGB_GameScene_measureLines(
+    PGB_FramePacing *pacing, float time, int line_count)
+{
+    if (line_count > 0)
+    {
+        pacing->line_time_s +=
+            (time / line_count - pacing->line_time_s) * PACING_EWMA_WEIGHT;
     }
 }
+#endif
 
-static void save_check(struct gb_s *gb);
+// Frames to run this update when emulation follows the audio clock: one
+// fewer than usual when the audio callback has fallen behind (with one
+// usual frame, the last frame stays on screen), one more when it has caught
+// up with the emulation, otherwise as usual.
+__section__(".text.tick") static int PGB_GameScene_audioPacedFrames(
+    PGB_FramePacing *pacing, int usual)
+{
+    struct audio_stats stats;
+    audio_get_stats(&stats);
+
+    if (stats.fill >= AUDIO_PACING_FILL_HIGH)
+    {
+        pacing->audio_held++;
+        return usual - 1;
+    }
+    if (stats.fill < AUDIO_PACING_FILL_LOW)
+    {
+        pacing->audio_caught_up++;
+        return usual + 1;
+    }
+    return usual;
+}
 
 __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
 {
@@ -680,6 +1026,11 @@ __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
     PGB_Scene_update(gameScene->scene);
 
     float progress = 0.5f;
+    float pan_progress = 0.5f;
+
+    const float triggerAngle = gameScene->scale_mode == PGB_ScaleMode2x
+                                   ? SCALE_PAN_TRIGGER_ANGLE
+                                   : gameScene->selector.triggerAngle;
 
     gameScene->selector.startPressed = false;
     gameScene->selector.selectPressed = false;
@@ -690,33 +1041,36 @@ __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
 
         if (angle <= (180 - gameScene->selector.deadAngle))
         {
-            if (angle >= gameScene->selector.triggerAngle)
+            if (angle >= triggerAngle)
             {
                 gameScene->selector.startPressed = true;
             }
 
-            float adjustedAngle =
-                fminf(angle, gameScene->selector.triggerAngle);
-            progress =
-                0.5f - adjustedAngle / gameScene->selector.triggerAngle * 0.5f;
+            float adjustedAngle = fminf(angle, triggerAngle);
+            progress = 0.5f - adjustedAngle / triggerAngle * 0.5f;
         }
         else if (angle >= (180 + gameScene->selector.deadAngle))
         {
-            if (angle <= (360 - gameScene->selector.triggerAngle))
+            if (angle <= (360 - triggerAngle))
             {
                 gameScene->selector.selectPressed = true;
             }
 
-            float adjustedAngle =
-                fminf(360 - angle, gameScene->selector.triggerAngle);
-            progress =
-                0.5f + adjustedAngle / gameScene->selector.triggerAngle * 0.5f;
+            float adjustedAngle = fminf(360 - angle, triggerAngle);
+            progress = 0.5f + adjustedAngle / triggerAngle * 0.5f;
         }
         else
         {
             gameScene->selector.startPressed = true;
             gameScene->selector.selectPressed = true;
         }
+
+        if (angle <= 180)
+            pan_progress =
+                0.5f - fminf(angle, SCALE_PAN_ANGLE) / SCALE_PAN_ANGLE * 0.5f;
+        else
+            pan_progress = 0.5f + fminf(360 - angle, SCALE_PAN_ANGLE) /
+                                      SCALE_PAN_ANGLE * 0.5f;
     }
 
     int selectorIndex;
@@ -742,6 +1096,15 @@ __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
 
     gameScene->selector.index = selectorIndex;
 
+    // in 2x mode, the crank pans the view over the gameboy screen (docked:
+    // centred).
+    unsigned scale_pan = 0;
+    if (gameScene->scale_mode == PGB_ScaleMode2x)
+    {
+        scale_pan =
+            roundf((1.0f - pan_progress) * (LCD_HEIGHT - PGB_LCD_HEIGHT / 2));
+    }
+
     bool gbScreenRequiresFullRefresh = false;
     if (gameScene->model.empty || gameScene->model.state != gameScene->state ||
         gameScene->model.error != gameScene->error)
@@ -749,6 +1112,17 @@ __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
         gbScreenRequiresFullRefresh = true;
     }
 
+    // every visible line moves when panning
+    bool gbScreenRequiresRedraw = gbScreenRequiresFullRefresh;
+    if (scale_pan != gameScene->scale_pan)
+    {
+        gameScene->scale_pan = scale_pan;
+        gbScreenRequiresRedraw = true;
+    }
+
+    // the stretched screen covers the selector
+    bool selectorVisible = gameScene->scale_mode != PGB_ScaleModeStretch;
+
     bool animatedSelectorBitmapNeedsRedraw = false;
     if (gbScreenRequiresFullRefresh || !gameScene->staticSelectorUIDrawn ||
         gameScene->model.selectorIndex != gameScene->selector.index)
@@ -783,15 +1157,7 @@ __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
         context->gb->direct.joypad_bits.start = gb_joypad_start_is_active_low;
         context->gb->direct.joypad_bits.select = gb_joypad_select_is_active_low;
 
-        context->gb->direct.joypad_bits.a = !(current_pd_buttons & kButtonA);
-        context->gb->direct.joypad_bits.b = !(current_pd_buttons & kButtonB);
-        context->gb->direct.joypad_bits.left =
-            !(current_pd_buttons & kButtonLeft);
-        context->gb->direct.joypad_bits.up = !(current_pd_buttons & kButtonUp);
-        context->gb->direct.joypad_bits.right =
-            !(current_pd_buttons & kButtonRight);
-        context->gb->direct.joypad_bits.down =
-            !(current_pd_buttons & kButtonDown);
+        gb_joypad_from_buttons(context->gb, current_pd_buttons);
 
         if (gbScreenRequiresFullRefresh)
         {
@@ -802,127 +1168,227 @@ __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
         memset(gameScene->debug_updatedRows, 0, LCD_ROWS);
 #endif
 
-        context->gb->direct.sram_updated = 0;
+        // input ends the reduced refresh rate at once, and an idle stretch
+        bool input_changed = current_pd_buttons != context->idle_buttons ||
+                             animatedSelectorBitmapNeedsRedraw;
+        context->idle_buttons = current_pd_buttons;
+        if (input_changed || gbScreenRequiresRedraw)
+        {
+            context->idle_frames = 0;
+            context->idle_slow = false;
+        }
 
-#ifndef NOLUA
-        if (context->scene->script)
+        // temporal dithering: odd frames use the complementary tile. Only
+        // shades 1 and 2 look different in the two tiles, so lines holding
+        // them are redrawn every frame as if changed. While the screen is
+        // idle nothing is redrawn and it keeps the last frame's tile.
+        static unsigned dither_frame = 0;
+        PGB_dither_row_offset =
+            (++dither_frame & 1) ? PGB_dither_temporal_rows : 0;
+
+#if DIRECT_LINE_OUTPUT
+        context->direct_fb = playdate->graphics->getFrame();
+        context->direct_fb_force = gbScreenRequiresRedraw;
+        memset(context->direct_line_changed, 0,
+               sizeof(context->direct_line_changed));
+#endif
+
+        // at the reduced refresh rate, two frames are run per update
+        int frames_to_run = context->idle_slow ? 2 : 1;
+        if (gameScene->audio_pacing && context->gb->direct.sound)
         {
-            script_tick(context->scene->script);
+            frames_to_run = PGB_GameScene_audioPacedFrames(&context->pacing,
+                                                           frames_to_run);
         }
+        for (int frame = 0; frame < frames_to_run; frame++)
+        {
+            context->gb->direct.sram_updated = 0;
+
+#ifndef NOLUA
+            if (context->scene->script)
+            {
+                script_tick(context->scene->script);
+            }
 #endif
 
-        PGB_ASSERT(context == context->gb->direct.priv);
+            PGB_ASSERT(context == context->gb->direct.priv);
 
 #ifdef DTCM_ALLOC
-        DTCM_VERIFY_DEBUG();
-        ITCM_CORE_FN(gb_run_frame)(context->gb);
-        DTCM_VERIFY_DEBUG();
+            DTCM_VERIFY_DEBUG();
+            ITCM_CORE_FN(gb_run_frame)(context->gb);
+            DTCM_VERIFY_DEBUG();
 #else
-        // copy gb to stack (DTCM) temporarily
-        struct gb_s gb;
-        struct gb_s *tmp_gb = context->gb;
-        context->gb = &gb;
-        memcpy(&gb, tmp_gb, sizeof(struct gb_s));
+            // copy gb to stack (DTCM) temporarily
+            struct gb_s gb;
+            struct gb_s *tmp_gb = context->gb;
+            context->gb = &gb;
+            memcpy(&gb, tmp_gb, sizeof(struct gb_s));
 
-        gb_run_frame(&gb);
+            gb_run_frame(&gb);
 
-        memcpy(tmp_gb, &gb, sizeof(struct gb_s));
-        context->gb = tmp_gb;
+            memcpy(tmp_gb, &gb, sizeof(struct gb_s));
+            context->gb = tmp_gb;
 #endif
 
-        if (context->gb->cart_battery)
-        {
-            save_check(context->gb);
-        }
-
-#if DYNAMIC_RATE_ADJUSTMENT
-        float logic_time = playdate->system->getElapsedTime();
-#endif
+            if (context->gb->direct.sound)
+            {
+                audio_end_frame();
+                audio_record_frame();
+            }
 
-        // --- Conditional Screen Update (Drawing) Logic ---
-        uint8_t *current_lcd = context->gb->lcd;
-        int line_changed_count = 0;
-        uint16_t line_has_changed[LCD_HEIGHT / 16];
-        for (int y = 0; y < LCD_HEIGHT / 16; y++)
-        {
-            uint16_t changed = 0;
-            for (int y2 = 0; y2 < 16; ++y2)
+            if (context->gb->cart_battery)
             {
-                changed >>= 1;
-                uint8_t sy = (y * 16) | y2;
-                if (memcmp(&current_lcd[sy * LCD_WIDTH_PACKED],
-                           &context->previous_lcd[sy * LCD_WIDTH_PACKED],
-                           LCD_WIDTH_PACKED) != 0)
-                {
-                    changed |= 0x8000;
-                }
+                save_check(context->gb);
             }
 
-            line_has_changed[y] = changed;
+            if (context->gb->display_written ||
+                context->gb->halt_cycles < IDLE_MIN_HALT_CYCLES)
+            {
+                context->idle_frames = 0;
+                context->idle_slow = false;
+            }
+            else if (context->idle_frames < IDLE_SETTLE_FRAMES)
+            {
+                context->idle_frames++;
+            }
         }
 
-#if DYNAMIC_RATE_ADJUSTMENT
-        uint16_t interlace_mask = 0xFFFF;
-        static int interlace_i = 0;
-        float time_for_rendering =
-            TARGET_RENDER_TIME_S - LINE_RENDER_MARGIN_S - logic_time;
-        static int frame_i = 0;
-        if (++frame_i % 256 == 16)
+        // the gameboy screen is exactly as it was last presented
+        bool gb_screen_idle = context->idle_frames >= IDLE_SETTLE_FRAMES &&
+                              context->lcd_presented &&
+                              !gbScreenRequiresRedraw;
+        if (gb_screen_idle)
         {
-            printf("logic: %f, time for rendering: %f; %f\n",
-                   1000 * (double)logic_time, 1000 * (double)time_for_rendering,
-                   1000 * (double)(line_changed_count * LINE_RENDER_TIME_S));
+            context->pacing.frames_idle++;
+            context->idle_slow = gameScene->idle_slowdown;
         }
-        if (time_for_rendering < line_changed_count * LINE_RENDER_TIME_S)
-        {
-            ++interlace_i;
 
-            if (time_for_rendering >=
-                line_changed_count * LINE_RENDER_TIME_S * 0.75f)
-            {
-                // render 3 out of 4 lines
-                interlace_mask = 0b11101110111011101110 >> (interlace_i % 4);
-            }
-            else
+#if DIRECT_LINE_OUTPUT
+        // lines were already dithered into the framebuffer during the frame;
+        // only the display update remains. None are ever held back.
+        context->direct_fb = NULL;
+        context->lcd_presented = true;
+        PGB_RowMarker marker = {
+            .markUpdateRows = playdate->graphics->markUpdatedRows};
+        for (int y = 0; y < LCD_HEIGHT; y++)
+        {
+            if ((context->direct_line_changed[y / 16] >> (y % 16)) & 1)
             {
-                // render 1 out of 2 lines
-                interlace_mask =
-                    (interlace_i % 2) ? 0b1010101010101010 : 0b0101010101010101;
+                row_marker_add(&marker, context->direct_line_top[y],
+                               context->direct_line_height[y]);
             }
         }
-
-        static volatile int k = 0;
-        if (k == 1)
-            interlace_mask = 0xFFFF;
+        row_marker_flush(&marker);
+        context->pacing.mark_calls = marker.calls;
+        context->pacing.mark_rows = marker.rows;
+#else
+#if DYNAMIC_RATE_ADJUSTMENT
+        // per frame, for the pacing estimates
+        float logic_time = playdate->system->getElapsedTime() /
+                           (float)PGB_MAX(frames_to_run, 1);
 #endif
 
-        // Determine if drawing is actually needed based on changes or
-        // forced display
-        bool actual_gb_draw_needed = true;
-        // gbScreenRequiresFullRefresh;
+        // --- Conditional Screen Update (Drawing) Logic ---
+        // Determine if drawing is actually needed: an idle frame cannot
+        // differ from what is on screen, so not even the compare is needed
+        bool actual_gb_draw_needed = !gb_screen_idle;
 
         if (actual_gb_draw_needed)
         {
-            if (gbScreenRequiresFullRefresh)
+            uint8_t *current_lcd = context->gb->lcd;
+            if (gameScene->frame_blend != PGB_FrameBlendOff)
             {
-                for (int i = 0; i < LCD_HEIGHT / 16; i++)
+                ITCM_CORE_FN(gb_blend_frame)(context->blend_lcd, current_lcd,
+                                             context->blend_last_lcd,
+                                             gameScene->frame_blend);
+                current_lcd = context->blend_lcd;
+            }
+            uint16_t line_has_changed[LCD_HEIGHT / 16];
+            memset(line_has_changed, 0, sizeof(line_has_changed));
+#if DYNAMIC_RATE_ADJUSTMENT
+            // number of changed pixels on each line
+            uint8_t line_diff[LCD_HEIGHT];
+#endif
+            // temporal dithering: a line holding shade 1 or 2 (a pixel whose
+            // two bits differ) changes with the phase, so it counts as
+            // changed, and towards the pacer's budget, even if its pixels
+            // did not
+            const uint32_t grey_mask =
+                PGB_dither_temporal_rows ? 0x55555555 : 0;
+            for (int y = 0; y < LCD_HEIGHT; y++)
+            {
+                const uint32_t *cur = (const uint32_t *)(void *)&current_lcd
+                    [y * LCD_WIDTH_PACKED];
+                const uint32_t *prev = (const uint32_t *)(void *)&context
+                    ->previous_lcd[y * LCD_WIDTH_PACKED];
+                unsigned diff = 0;
+                uint32_t grey = 0;
+                for (int i = 0; i < LCD_WIDTH_PACKED / 4; i++)
                 {
-                    line_has_changed[i] = 0xFFFF;
+                    uint32_t x = cur[i] ^ prev[i];
+                    grey |= cur[i] ^ (cur[i] >> 1);
+#if DYNAMIC_RATE_ADJUSTMENT
+                    if (x)
+                        diff +=
+                            __builtin_popcount((x | (x >> 1)) & 0x55555555);
+#else
+                    diff |= x;
+#endif
                 }
+
+#if DYNAMIC_RATE_ADJUSTMENT
+                line_diff[y] = diff;
+#endif
+                if (diff || (grey & grey_mask))
+                    line_has_changed[y / 16] |= 1 << (y % 16);
             }
+
+            context->lcd_presented = true;
 #if DYNAMIC_RATE_ADJUSTMENT
-            else
+            PGB_FramePacing *pacing = &context->pacing;
+            pacing->frames++;
+#endif
+            if (gbScreenRequiresRedraw)
             {
                 for (int i = 0; i < LCD_HEIGHT / 16; i++)
                 {
-                    line_has_changed[i] &= interlace_mask;
+                    line_has_changed[i] = 0xFFFF;
                 }
+#if DYNAMIC_RATE_ADJUSTMENT
+                memset(pacing->line_age, 0, sizeof(pacing->line_age));
+                pacing->frames_full++;
+                pacing->lines_pushed += LCD_HEIGHT;
+#endif
             }
+#if DYNAMIC_RATE_ADJUSTMENT
+            else if (PGB_GameScene_paceLines(pacing, logic_time,
+                                             line_has_changed, line_diff) > 0)
+            {
+                // lines held back still differ from what is on screen
+                context->lcd_presented = false;
+            }
+
+            float render_start = playdate->system->getElapsedTime();
 #endif
 
+            PGB_RowMarker marker = {
+                .markUpdateRows = playdate->graphics->markUpdatedRows};
             ITCM_CORE_FN(update_fb_dirty_lines)(
                 playdate->graphics->getFrame(), current_lcd, line_has_changed,
-                playdate->graphics->markUpdatedRows);
+                &marker, gameScene->scale_mode, gameScene->scale_pan);
+            context->pacing.mark_calls = marker.calls;
+            context->pacing.mark_rows = marker.rows;
+
+#if DYNAMIC_RATE_ADJUSTMENT
+            int lines_rendered = 0;
+            for (int i = 0; i < LCD_HEIGHT / 16; i++)
+            {
+                lines_rendered += __builtin_popcount(line_has_changed[i]);
+            }
+            PGB_GameScene_measureLines(
+                pacing, playdate->system->getElapsedTime() - render_start,
+                lines_rendered);
+#endif
 
             for (int i = 0; i < LCD_HEIGHT; i++)
             {
@@ -934,54 +1400,18 @@ __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
                 }
             }
         }
+#endif
 
-        // Always request the update loop to run at 60 FPS.
-        // This ensures gb_run_frame() is called at a consistent rate.
-        gameScene->scene->preferredRefreshRate = 60;
+        // Run the update loop at 60 FPS, or at 30 FPS running two frames
+        // per update while idle. Either way gb_run_frame() is called at a
+        // consistent rate.
+        const float refresh_rate = context->idle_slow ? 30.0f : 60.0f;
+        gameScene->scene->preferredRefreshRate = refresh_rate;
         gameScene->scene->refreshRateCompensation =
-            (1.0f / 60.0f - PGB_App->dt);
-
-        if (gameScene->cartridge_has_rtc)
-        {
-            const uint8_t MAX_RTC_TICKS_PER_FRAME = 1;
-            const uint8_t MAX_CATCH_UP_INCREMENT = 255;  // 4 minutes 15 seconds
-
-            gameScene->rtc_fractional_second_accumulator += PGB_App->dt;
-
-            if (gameScene->rtc_fractional_second_accumulator >= 1.0f)
-            {
-                unsigned int total_whole_seconds_accumulated =
-                    (unsigned int)gameScene->rtc_fractional_second_accumulator;
-
-                uint8_t seconds_to_process_now;
-
-                if (total_whole_seconds_accumulated > MAX_CATCH_UP_INCREMENT)
-                {
-                    seconds_to_process_now = MAX_CATCH_UP_INCREMENT;
-                }
-                else
-                {
-                    seconds_to_process_now =
-                        (uint8_t)total_whole_seconds_accumulated;
-                }
-
-                gameScene->rtc_seconds_to_catch_up += seconds_to_process_now;
-                gameScene->rtc_fractional_second_accumulator -=
-                    (float)seconds_to_process_now;
-                gameScene->rtc_time += seconds_to_process_now;
-            }
+            (1.0f / refresh_rate - PGB_App->dt);
 
-            uint8_t ticks_this_frame = 0;
-            while (gameScene->rtc_seconds_to_catch_up > 0 &&
-                   ticks_this_frame < MAX_RTC_TICKS_PER_FRAME)
-            {
-                gb_tick_rtc(context->gb);
-                gameScene->rtc_seconds_to_catch_up--;
-                ticks_this_frame++;
-            }
-        }
-
-        if (!gameScene->staticSelectorUIDrawn || gbScreenRequiresFullRefresh)
+        if (selectorVisible &&
+            (!gameScene->staticSelectorUIDrawn || gbScreenRequiresFullRefresh))
         {
             playdate->graphics->setFont(PGB_App->labelFont);
             playdate->graphics->setDrawMode(kDrawModeFillWhite);
@@ -996,7 +1426,7 @@ __section__(".text.tick") __space static void PGB_GameScene_update(void *object)
             playdate->graphics->setDrawMode(kDrawModeCopy);
         }
 
-        if (animatedSelectorBitmapNeedsRedraw)
+        if (selectorVisible && animatedSelectorBitmapNeedsRedraw)
         {
             LCDBitmap *bitmap;
             // Use gameScene->selector.index, which is the most current
@@ -1174,6 +1604,103 @@ __section__(".rare") void PGB_GameScene_didSelectLibrary(void *userdata)
     DTCM_VERIFY();
 }
 
+__section__(".rare") static void PGB_GameScene_didChangeScaleMode(
+    void *userdata)
+{
+    PGB_GameScene *gameScene = userdata;
+
+    int mode = playdate->system->getMenuItemValue(scaleModeMenuItem);
+    if (mode < 0 || mode >= PGB_ScaleModeCount)
+    {
+        mode = PGB_ScaleModeFit;
+    }
+
+    preferences_scale_mode = mode;
+    gameScene->scale_mode = mode;
+
+    // clears the screen and redraws every line in the new layout
+    gameScene->model.empty = true;
+}
+
+__section__(".rare") void PGB_GameScene_setFrameBlend(
+    PGB_GameScene *gameScene, PGB_FrameBlend frame_blend)
+{
+    PGB_GameSceneContext *context = gameScene->context;
+
+    if (frame_blend >= PGB_FrameBlendCount)
+    {
+        frame_blend = PGB_FrameBlendOff;
+    }
+
+    if (frame_blend != PGB_FrameBlendOff &&
+        gameScene->frame_blend == PGB_FrameBlendOff && context->gb &&
+        context->gb->lcd)
+    {
+        // nothing to blend with yet
+        memcpy(context->blend_last_lcd, context->gb->lcd,
+               sizeof(context->blend_last_lcd));
+    }
+
+    gameScene->frame_blend = frame_blend;
+}
+
+__section__(".rare") void PGB_GameScene_setInputSampling(
+    PGB_GameScene *gameScene, PGB_InputSampling input_sampling,
+    uint8_t sample_line)
+{
+    if (gameScene->state != PGB_GameSceneStateLoaded)
+        return;
+
+    struct gb_s *gb = gameScene->context->gb;
+    switch (input_sampling)
+    {
+    case PGB_InputSamplingLine:
+        gb_init_joypad(gb, gb_joypad_sample, sample_line);
+        break;
+    case PGB_InputSamplingPoll:
+        gb_init_joypad(gb, gb_joypad_sample, JOYPAD_SAMPLE_ON_P1);
+        break;
+    default:
+        gb_init_joypad(gb, NULL, 0);
+        break;
+    }
+}
+
+__section__(".rare") void PGB_GameScene_setIdleSlowdown(
+    PGB_GameScene *gameScene, bool idle_slowdown)
+{
+    gameScene->idle_slowdown = idle_slowdown;
+    if (!idle_slowdown && gameScene->state == PGB_GameSceneStateLoaded)
+    {
+        gameScene->context->idle_slow = false;
+    }
+}
+
+__section__(".rare") void PGB_GameScene_setAudioPacing(PGB_GameScene *gameScene,
+                                                     bool audio_pacing)
+{
+    gameScene->audio_pacing = audio_pacing;
+    audio_set_paced(audio_pacing);
+}
+
+__section__(".rare") static void PGB_GameScene_didChangeDitherMode(
+    void *userdata)
+{
+    PGB_GameScene *gameScene = userdata;
+
+    int mode = playdate->system->getMenuItemValue(ditherModeMenuItem);
+    if (mode < 0 || mode >= PGB_DitherModeCount)
+    {
+        mode = PGB_DitherModePattern;
+    }
+
+    preferences_dither_mode = mode;
+    gameScene->dither_mode = mode;
+    PGB_Dither_updateTables(gameScene->dither_mode);
+
+    gameScene->model.empty = true;
+}
+
 static void PGB_GameScene_menu(void *object)
 {
     PGB_GameScene *gameScene = object;
@@ -1253,6 +1780,18 @@ static void PGB_GameScene_menu(void *object)
 
     playdate->system->addMenuItem("Library", PGB_GameScene_didSelectLibrary,
                                   gameScene);
+
+    scaleModeMenuItem = playdate->system->addOptionsMenuItem(
+        "Scaling", scaleModeOptions, PGB_ScaleModeCount,
+        PGB_GameScene_didChangeScaleMode, gameScene);
+    playdate->system->setMenuItemValue(scaleModeMenuItem,
+                                       gameScene->scale_mode);
+
+    ditherModeMenuItem = playdate->system->addOptionsMenuItem(
+        "Dither", ditherModeOptions, PGB_DitherModeCount,
+        PGB_GameScene_didChangeDitherMode, gameScene);
+    playdate->system->setMenuItemValue(ditherModeMenuItem,
+                                       gameScene->dither_mode);
 }
 
 static void PGB_GameScene_generateBitmask(void)
@@ -1316,8 +1855,7 @@ __section__(".rare") static void PGB_GameScene_event(void *object,
             // save a recovery file
             char *recovery_filename =
                 pgb_save_filename(context->scene->rom_filename, true);
-            write_cart_ram_file(recovery_filename, context->gb->gb_cart_ram,
-                                gb_get_save_size(context->gb));
+            write_cart_ram_file(recovery_filename, context->gb);
             pgb_free(recovery_filename);
         }
         break;
@@ -1328,6 +1866,7 @@ __section__(".rare") static void PGB_GameScene_event(void *object,
 
 static void PGB_GameScene_free(void *object)
 {
+    audio_record_stop();
     audio_enabled = 0;
 
     DTCM_VERIFY_DEBUG();
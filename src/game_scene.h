@@ -12,6 +12,7 @@
 #include <math.h>
 #include <stdio.h>
 
+#include "dither.h"
 #include "peanut_gb.h"
 #include "scene.h"
 
@@ -34,6 +35,25 @@ typedef enum
     PGB_GameSceneErrorFatal
 } PGB_GameSceneError;
 
+// merges each frame with the previous one before dithering, so that
+// sprites multiplexed at 30 Hz don't flicker (and don't force redraws).
+typedef enum
+{
+    PGB_FrameBlendOff,
+    PGB_FrameBlendMax,      // darker shade of the two
+    PGB_FrameBlendAverage,  // mean shade, rounded towards darker
+    PGB_FrameBlendCount
+} PGB_FrameBlend;
+
+// when the buttons are read, besides once before each frame
+typedef enum
+{
+    PGB_InputSamplingFrame,  // only once per frame
+    PGB_InputSamplingLine,   // again when the LCD reaches a given line
+    PGB_InputSamplingPoll,   // again when the game first polls the joypad
+    PGB_InputSamplingCount
+} PGB_InputSampling;
+
 typedef struct
 {
     PGB_GameSceneState state;
@@ -64,6 +84,34 @@ typedef struct
     bool selectPressed;
 } PGB_CrankSelector;
 
+// frame pacing (DYNAMIC_RATE_ADJUSTMENT): measured costs, and counters of
+// the decisions made from them since the game was loaded.
+typedef struct
+{
+    float logic_time_s;  // emulation, per frame (moving average)
+    float line_time_s;   // dither + mark updated, per GB line (moving average)
+
+    uint32_t frames;
+    uint32_t frames_full;     // every changed line was pushed
+    uint32_t frames_partial;  // some changed lines were held back
+    uint32_t frames_skipped;  // no lines were pushed
+    uint32_t lines_pushed;
+    uint32_t lines_deferred;
+    uint32_t lines_forced;  // pushed over budget, having waited too long
+    uint32_t frames_idle;   // not even compared: the game was idle
+
+    // updates audio pacing ran fewer frames than usual in, or more
+    uint32_t audio_held;
+    uint32_t audio_caught_up;
+
+    // markUpdatedRows calls, and display rows marked, on the last frame
+    uint16_t mark_calls;
+    uint16_t mark_rows;
+
+    // frames each changed line has been held back for
+    uint8_t line_age[LCD_HEIGHT];
+} PGB_FramePacing;
+
 struct gb_s;
 
 typedef struct PGB_GameSceneContext
@@ -78,6 +126,28 @@ typedef struct PGB_GameSceneContext
         previous_lcd[LCD_HEIGHT *
                      LCD_WIDTH_PACKED];  // Buffer for the previous frame's LCD
 
+    // DIRECT_LINE_OUTPUT: framebuffer to dither lines into while a frame is
+    // being emulated (NULL otherwise), and which lines were written.
+    uint8_t *direct_fb;
+    bool direct_fb_force;
+    uint16_t direct_line_changed[LCD_HEIGHT / 16];
+    uint8_t direct_line_top[LCD_HEIGHT];
+    uint8_t direct_line_height[LCD_HEIGHT];
+
+    // frame blending: the previous unblended frame, and the blended one
+    uint8_t blend_last_lcd[LCD_HEIGHT * LCD_WIDTH_PACKED];
+    uint8_t blend_lcd[LCD_HEIGHT * LCD_WIDTH_PACKED];
+
+    PGB_FramePacing pacing;
+
+    // idle detection: frames in a row the CPU mostly halted without
+    // changing the picture (up to IDLE_SETTLE_FRAMES), whether two frames
+    // are being run per update at 30 FPS, and the buttons last update.
+    uint8_t idle_frames;
+    bool idle_slow;
+    PDButtons idle_buttons;
+    bool lcd_presented;  // previous_lcd is what is on screen, in full
+
     int buttons_held_since_start;  // buttons that have been down since the
                                    // start of the game
 } PGB_GameSceneContext;
@@ -94,11 +164,6 @@ typedef struct PGB_GameScene
     bool staticSelectorUIDrawn;
     bool save_data_loaded_successfully;
 
-    unsigned int rtc_time;
-    uint16_t rtc_seconds_to_catch_up;
-
-    float rtc_fractional_second_accumulator;
-
     PGB_GameSceneState state;
     PGB_GameSceneContext *context;
     PGB_GameSceneModel model;
@@ -106,6 +171,13 @@ typedef struct PGB_GameScene
 
     PGB_CrankSelector selector;
 
+    PGB_ScaleMode scale_mode;
+    unsigned scale_pan;  // first visible line in PGB_ScaleMode2x
+    PGB_DitherMode dither_mode;
+    PGB_FrameBlend frame_blend;
+    bool idle_slowdown;  // drop to 30 FPS while the game is idle
+    bool audio_pacing;   // run frames to keep the audio queue filled
+
 #if PGB_DEBUG && PGB_DEBUG_UPDATED_ROWS
     PDRect debug_highlightFrame;
     bool debug_updatedRows[LCD_ROWS];
@@ -115,5 +187,13 @@ typedef struct PGB_GameScene
 } PGB_GameScene;
 
 PGB_GameScene *PGB_GameScene_new(const char *rom_filename);
+void PGB_GameScene_setFrameBlend(PGB_GameScene *gameScene,
+                                 PGB_FrameBlend frame_blend);
+void PGB_GameScene_setInputSampling(PGB_GameScene *gameScene,
+                                    PGB_InputSampling input_sampling,
+                                    uint8_t sample_line);
+void PGB_GameScene_setIdleSlowdown(PGB_GameScene *gameScene,
+                                   bool idle_slowdown);
+void PGB_GameScene_setAudioPacing(PGB_GameScene *gameScene, bool audio_pacing);
 
 #endif /* game_scene_h */
@@ -348,10 +348,29 @@ static void PGB_LibraryScene_update(void *object)
     }
 }
 
+// "low" synthesises at 11025 Hz and "on" at 22050 Hz; "hq" synthesises
+// at 44100 Hz, band-limited
+static const char *soundOptions[] = {"off", "low", "on", "hq"};
+
+static int PGB_LibraryScene_soundOption(void)
+{
+    if (!preferences_sound_enabled)
+    {
+        return 0;
+    }
+    if (preferences_sound_quality)
+    {
+        return 3;
+    }
+    return preferences_sound_rate <= 11025 ? 1 : 2;
+}
+
 static void PGB_LibraryScene_didChangeSound(void *userdata)
 {
-    preferences_sound_enabled =
-        playdate->system->getMenuItemValue(audioMenuItem);
+    int value = playdate->system->getMenuItemValue(audioMenuItem);
+    preferences_sound_enabled = value != 0;
+    preferences_sound_quality = value == 3 ? 1 : 0;
+    preferences_sound_rate = value == 1 ? 11025 : value == 3 ? 44100 : 22050;
 }
 
 static void PGB_LibraryScene_didChangeFPS(void *userdata)
@@ -369,9 +388,11 @@ static void PGB_LibraryScene_menu(void *object)
 {
     PGB_LibraryScene *libraryScene = object;
 
-    audioMenuItem = playdate->system->addCheckmarkMenuItem(
-        "Sound", preferences_sound_enabled, PGB_LibraryScene_didChangeSound,
+    audioMenuItem = playdate->system->addOptionsMenuItem(
+        "Sound", soundOptions, 4, PGB_LibraryScene_didChangeSound,
         libraryScene);
+    playdate->system->setMenuItemValue(audioMenuItem,
+                                       PGB_LibraryScene_soundOption());
     frameSkipMenuItem = playdate->system->addCheckmarkMenuItem(
         "Frame skip", preferences_frame_skip,
         PGB_LibraryScene_didChangeFrameSkip, libraryScene);
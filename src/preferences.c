@@ -8,14 +8,18 @@
 
 #include "preferences.h"
 
-static const int pref_version = 2;
+static const int pref_version = 6;
 
 static const char *pref_filename = "preferences.bin";
 static SDFile *pref_file;
 
 bool preferences_sound_enabled = false;
+uint8_t preferences_sound_quality = 0;
+uint32_t preferences_sound_rate = 22050;
 bool preferences_display_fps = false;
 bool preferences_frame_skip = false;
+uint8_t preferences_scale_mode = 0;
+uint8_t preferences_dither_mode = 0;
 
 static void cpu_endian_to_big_endian(unsigned char *src, unsigned char *buffer,
                                      size_t size, size_t len);
@@ -28,8 +32,12 @@ static void preferences_write_uint32(uint32_t value);
 void preferences_init(void)
 {
     preferences_sound_enabled = true;
+    preferences_sound_quality = 0;
+    preferences_sound_rate = 22050;
     preferences_display_fps = false;
     preferences_frame_skip = true;
+    preferences_scale_mode = 0;
+    preferences_dither_mode = 0;
 
     if (playdate->file->stat(pref_filename, NULL) != 0)
     {
@@ -57,6 +65,26 @@ void preferences_read_from_disk(void)
             preferences_frame_skip = preferences_read_uint8();
         }
 
+        if (version >= 3)
+        {
+            preferences_scale_mode = preferences_read_uint8();
+        }
+
+        if (version >= 4)
+        {
+            preferences_dither_mode = preferences_read_uint8();
+        }
+
+        if (version >= 5)
+        {
+            preferences_sound_quality = preferences_read_uint8();
+        }
+
+        if (version >= 6)
+        {
+            preferences_sound_rate = preferences_read_uint32();
+        }
+
         playdate->file->close(pref_file);
     }
 }
@@ -70,6 +98,10 @@ void preferences_save_to_disk(void)
     preferences_write_uint8(preferences_sound_enabled ? 1 : 0);
     preferences_write_uint8(preferences_display_fps ? 1 : 0);
     preferences_write_uint8(preferences_frame_skip ? 1 : 0);
+    preferences_write_uint8(preferences_scale_mode);
+    preferences_write_uint8(preferences_dither_mode);
+    preferences_write_uint8(preferences_sound_quality);
+    preferences_write_uint32(preferences_sound_rate);
 
     playdate->file->close(pref_file);
 }
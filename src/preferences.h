@@ -14,8 +14,12 @@
 #include "utility.h"
 
 extern bool preferences_sound_enabled;
+extern uint8_t preferences_sound_quality;
+extern uint32_t preferences_sound_rate;
 extern bool preferences_display_fps;
 extern bool preferences_frame_skip;
+extern uint8_t preferences_scale_mode;
+extern uint8_t preferences_dither_mode;
 
 void preferences_init(void);
 
@@ -15,6 +15,7 @@
 
 #include "../peanut_gb/peanut_gb.h"
 #include "app.h"
+#include "audio_record.h"
 #include "dtcm.h"
 #include "game_scene.h"
 #include "jparse.h"
@@ -215,6 +216,187 @@ static int pgb_setCrankSoundsDisabled(lua_State *L)
     return 0;
 }
 
+static int pgb_set_frame_blend(lua_State *L)
+{
+    static const char *const modes[] = {"off", "max", "average", NULL};
+
+    if (!lua_check_args(L, 1, 1))
+    {
+        return luaL_error(L, "pgb.set_frame_blend(mode) takes one argument");
+    }
+
+    int mode = luaL_checkoption(L, 1, NULL, modes);
+    PGB_GameScene_setFrameBlend(get_game_scene(L), (PGB_FrameBlend)mode);
+    return 0;
+}
+
+static int pgb_set_input_sampling(lua_State *L)
+{
+    static const char *const modes[] = {"frame", "line", "poll", NULL};
+
+    if (!lua_check_args(L, 1, 2))
+    {
+        return luaL_error(
+            L, "pgb.set_input_sampling(mode, [line]) takes 1-2 arguments");
+    }
+
+    int mode = luaL_checkoption(L, 1, NULL, modes);
+    lua_Integer line = luaL_optinteger(L, 2, LCD_HEIGHT / 2);
+    if (line < 0 || line >= LCD_VERT_LINES)
+    {
+        return luaL_error(L, "pgb.set_input_sampling: line out of range");
+    }
+
+    PGB_GameScene_setInputSampling(get_game_scene(L), (PGB_InputSampling)mode,
+                                   (uint8_t)line);
+    return 0;
+}
+
+static int pgb_set_idle_slowdown(lua_State *L)
+{
+    if (!lua_check_args(L, 1, 1))
+    {
+        return luaL_error(L,
+                          "pgb.set_idle_slowdown(enabled) takes one argument");
+    }
+
+    PGB_GameScene_setIdleSlowdown(get_game_scene(L), lua_toboolean(L, 1));
+    return 0;
+}
+
+static int pgb_set_audio_pacing(lua_State *L)
+{
+    if (!lua_check_args(L, 1, 1))
+    {
+        return luaL_error(L,
+                          "pgb.set_audio_pacing(enabled) takes one argument");
+    }
+
+    PGB_GameScene_setAudioPacing(get_game_scene(L), lua_toboolean(L, 1));
+    return 0;
+}
+
+static int pgb_get_frame_pacing(lua_State *L)
+{
+    if (!lua_check_args(L, 0, 0))
+    {
+        return luaL_error(L, "pgb.get_frame_pacing() takes no arguments");
+    }
+
+    const PGB_FramePacing *pacing = &get_game_scene(L)->context->pacing;
+
+    lua_newtable(L);
+    lua_pushnumber(L, pacing->logic_time_s);
+    lua_setfield(L, -2, "logic_time");
+    lua_pushnumber(L, pacing->line_time_s);
+    lua_setfield(L, -2, "line_time");
+    lua_pushinteger(L, pacing->frames);
+    lua_setfield(L, -2, "frames");
+    lua_pushinteger(L, pacing->frames_full);
+    lua_setfield(L, -2, "frames_full");
+    lua_pushinteger(L, pacing->frames_partial);
+    lua_setfield(L, -2, "frames_partial");
+    lua_pushinteger(L, pacing->frames_skipped);
+    lua_setfield(L, -2, "frames_skipped");
+    lua_pushinteger(L, pacing->lines_pushed);
+    lua_setfield(L, -2, "lines_pushed");
+    lua_pushinteger(L, pacing->lines_deferred);
+    lua_setfield(L, -2, "lines_deferred");
+    lua_pushinteger(L, pacing->lines_forced);
+    lua_setfield(L, -2, "lines_forced");
+    lua_pushinteger(L, pacing->frames_idle);
+    lua_setfield(L, -2, "frames_idle");
+    lua_pushinteger(L, pacing->audio_held);
+    lua_setfield(L, -2, "audio_held");
+    lua_pushinteger(L, pacing->audio_caught_up);
+    lua_setfield(L, -2, "audio_caught_up");
+    lua_pushinteger(L, pacing->mark_calls);
+    lua_setfield(L, -2, "mark_calls");
+    lua_pushinteger(L, pacing->mark_rows);
+    lua_setfield(L, -2, "mark_rows");
+    return 1;
+}
+
+static int pgb_set_sound_rate(lua_State *L)
+{
+    if (!lua_check_args(L, 1, 1))
+    {
+        return luaL_error(L, "pgb.set_sound_rate(rate) takes one argument");
+    }
+
+    audio_set_sample_rate((uint32_t)luaL_checkinteger(L, 1));
+    return 0;
+}
+
+static int pgb_set_sound_gain(lua_State *L)
+{
+    if (!lua_check_args(L, 1, 1))
+    {
+        return luaL_error(L, "pgb.set_sound_gain(gain) takes one argument");
+    }
+
+    lua_Number gain = luaL_checknumber(L, 1);
+    if (!(gain >= 0))
+    {
+        return luaL_error(L, "pgb.set_sound_gain: gain must not be negative");
+    }
+
+    if (gain > (lua_Number)AUDIO_GAIN_MAX / AUDIO_GAIN_UNITY)
+        gain = (lua_Number)AUDIO_GAIN_MAX / AUDIO_GAIN_UNITY;
+
+    audio_set_gain((uint32_t)(gain * AUDIO_GAIN_UNITY));
+    return 0;
+}
+
+static int pgb_record_audio(lua_State *L)
+{
+    if (!lua_check_args(L, 2, 2))
+    {
+        return luaL_error(L,
+                          "pgb.record_audio(path, frames) takes two arguments");
+    }
+
+    const char *path = luaL_checkstring(L, 1);
+    lua_Integer frames = luaL_checkinteger(L, 2);
+
+    if (frames <= 0)
+    {
+        return luaL_error(L, "pgb.record_audio: frames must be positive");
+    }
+
+    if (!get_game_scene(L)->audioEnabled)
+    {
+        return luaL_error(L, "pgb.record_audio: sound is off");
+    }
+
+    lua_pushboolean(L, audio_record_start(path, (uint32_t)frames));
+    return 1;
+}
+
+static int pgb_get_audio_stats(lua_State *L)
+{
+    if (!lua_check_args(L, 0, 0))
+    {
+        return luaL_error(L, "pgb.get_audio_stats() takes no arguments");
+    }
+
+    struct audio_stats stats;
+    audio_get_stats(&stats);
+
+    lua_newtable(L);
+    lua_pushinteger(L, stats.underruns);
+    lua_setfield(L, -2, "underruns");
+    lua_pushinteger(L, stats.overruns);
+    lua_setfield(L, -2, "overruns");
+    lua_pushinteger(L, stats.silent);
+    lua_setfield(L, -2, "silent");
+    lua_pushinteger(L, stats.drift);
+    lua_setfield(L, -2, "drift");
+    lua_pushinteger(L, stats.fill);
+    lua_setfield(L, -2, "fill");
+    return 1;
+}
+
 void __gb_step_cpu(struct gb_s *gb);
 static int pgb_step_cpu(lua_State *L)
 {
@@ -403,6 +585,33 @@ __section__(".rare") static void register_pgb_library(lua_State *L)
         lua_pushcfunction(L, pgb_step_cpu);
         lua_setfield(L, -2, "step_cpu");
 
+        lua_pushcfunction(L, pgb_set_frame_blend);
+        lua_setfield(L, -2, "set_frame_blend");
+
+        lua_pushcfunction(L, pgb_set_input_sampling);
+        lua_setfield(L, -2, "set_input_sampling");
+
+        lua_pushcfunction(L, pgb_set_idle_slowdown);
+        lua_setfield(L, -2, "set_idle_slowdown");
+
+        lua_pushcfunction(L, pgb_set_audio_pacing);
+        lua_setfield(L, -2, "set_audio_pacing");
+
+        lua_pushcfunction(L, pgb_get_frame_pacing);
+        lua_setfield(L, -2, "get_frame_pacing");
+
+        lua_pushcfunction(L, pgb_set_sound_rate);
+        lua_setfield(L, -2, "set_sound_rate");
+
+        lua_pushcfunction(L, pgb_set_sound_gain);
+        lua_setfield(L, -2, "set_sound_gain");
+
+        lua_pushcfunction(L, pgb_record_audio);
+        lua_setfield(L, -2, "record_audio");
+
+        lua_pushcfunction(L, pgb_get_audio_stats);
+        lua_setfield(L, -2, "get_audio_stats");
+
         // pgb.regs
         lua_newtable(L);
         {
@@ -27,6 +27,10 @@ extern PlaydateAPI *playdate;
 #define PGB_LCD_X 32  // multiple of 8
 #define PGB_LCD_Y 0
 
+// 1:1 scale mode, centred
+#define PGB_LCD_1X_X 120  // multiple of 8
+#define PGB_LCD_1X_Y 48
+
 #define PGB_MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define PGB_MIN(x, y) (((x) < (y)) ? (x) : (y))
 
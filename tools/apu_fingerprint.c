@@ -0,0 +1,522 @@
+//
+//  apu_fingerprint.c
+//  CrankBoy
+//
+//  Host-side runner for the APU: renders fixed register-write workloads, or
+//  a ROM's sound, at exactly the Game Boy's frame rate and fingerprints the
+//  result the way pgb.record_audio does. `make apu-check` compares the
+//  built-in workloads with the references in apu_fingerprint.ref, so that a
+//  change to the APU either leaves its output bit-identical or shows which
+//  channels and modes it affects. The render is timed under the same
+//  workload every time, per frame and per call of AUDIO_RECORD_BLOCK
+//  samples, about the size of one audio callback.
+//
+//  usage: apu_fingerprint check REFS
+//         apu_fingerprint update REFS
+//         apu_fingerprint rom ROM FRAMES [WAV]
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PGB_IMPL
+#include "../minigb_apu/minigb_apu.h"
+#include "../peanut_gb/peanut_gb.h"
+#include "../src/audio_record.h"
+
+#define WORKLOAD_FRAMES 300
+
+static void log_line(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+static void log_error(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(2);
+}
+
+static struct playdate_sys host_system = {
+    .logToConsole = log_line,
+    .error = log_error,
+};
+static PlaydateAPI host_api = {.system = &host_system};
+PlaydateAPI *playdate = &host_api;
+
+void __gb_on_breakpoint(struct gb_s *gb, int breakpoint_number)
+{
+}
+
+/* Workloads: each makes the register writes of one frame. */
+
+static const uint16_t notes[8] = {
+    1046, 1155, 1253, 1297, 1379, 1452, 1517, 1546,
+};
+
+static void play_square(const uint32_t frame)
+{
+    if (frame == 0)
+    {
+        audio_write(0xFF11, 0x80, 0);
+        audio_write(0xFF12, 0xF3, 0);
+        audio_write(0xFF16, 0x40, 0);
+        audio_write(0xFF17, 0xA7, 0);
+    }
+
+    // an arpeggio on channel 2, cycling through the duties, at varying
+    // points in the frame
+    if (frame % 8 == 0)
+    {
+        const uint16_t f = notes[(frame / 8) % 8];
+        const uint32_t cycle = (frame / 8) % 4 * 17000;
+        audio_write(0xFF16, ((frame / 64) % 4) << 6, cycle);
+        audio_write(0xFF18, f & 0xFF, cycle);
+        audio_write(0xFF19, 0x80 | (f >> 8), cycle + 8);
+    }
+
+    // sweeps up and down on channel 1
+    if (frame % 30 == 0)
+    {
+        const uint16_t f = notes[(frame / 30) % 8] - 512;
+        audio_write(0xFF10, (frame / 30) % 2 ? 0x1D : 0x15, 1000);
+        audio_write(0xFF13, f & 0xFF, 1000);
+        audio_write(0xFF14, 0x80 | (f >> 8), 1008);
+    }
+}
+
+static void play_wave(const uint32_t frame)
+{
+    // a new wave every 20 frames, with the next output level
+    if (frame % 20 == 0)
+    {
+        const uint32_t n = frame / 20;
+        audio_write(0xFF1A, 0x00, 0);
+        for (uint16_t i = 0; i < 16; ++i)
+        {
+            const uint8_t hi = (i * 2 + n) % 16;
+            const uint8_t lo = n % 2 ? 15 - hi : (i * 2 + 1) % 16;
+            audio_write(0xFF30 + i, (hi << 4) | lo, 0);
+        }
+        audio_write(0xFF1A, 0x80, 0);
+        audio_write(0xFF1B, 0x00, 0);
+        audio_write(0xFF1C, (1 + n % 3) << 5, 0);
+    }
+
+    // new notes every 5 frames, retriggering every other one
+    if (frame % 5 == 0)
+    {
+        const uint16_t f = notes[(frame / 5) % 8] - 256;
+        const uint32_t cycle = 30000;
+        audio_write(0xFF1D, f & 0xFF, cycle);
+        audio_write(0xFF1E, ((frame / 5) % 2 ? 0x80 : 0) | (f >> 8), cycle);
+    }
+}
+
+static void play_noise(const uint32_t frame)
+{
+    static const uint8_t polys[8] = {
+        0x00, 0x11, 0x2A, 0x3F, 0x08, 0x55, 0x73, 0x9C,
+    };
+
+    // 15- and 7-bit noise at various rates, some cut short by the length
+    // counter
+    if (frame % 12 == 0)
+    {
+        const uint32_t n = frame / 12;
+        audio_write(0xFF20, 0x20, 500);
+        audio_write(0xFF21, n % 2 ? 0xF1 : 0x82, 500);
+        audio_write(0xFF22, polys[n % 8], 500);
+        audio_write(0xFF23, 0x80 | (n % 3 == 0 ? 0x40 : 0), 508);
+    }
+}
+
+static void play_arp(const uint32_t frame)
+{
+    if (frame == 0)
+    {
+        audio_write(0xFF16, 0x80, 0);
+        audio_write(0xFF17, 0xF0, 0);
+        audio_write(0xFF1A, 0x80, 0);
+        audio_write(0xFF1C, 0x20, 0);
+    }
+
+    // every write lands inside the frame, at its own cycle, so that only a
+    // replay at the right sample offset plays them all: a four-note
+    // arpeggio on channel 2,
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        const uint16_t f = notes[(frame + 2 * i) % 8];
+        const uint32_t cycle = 3000 + i * 17000;
+        audio_write(0xFF18, f & 0xFF, cycle);
+        audio_write(0xFF19, f >> 8, cycle);
+    }
+
+    // an envelope retriggered twice a frame on channel 1,
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        const uint32_t cycle = 10000 + i * 35000 + (frame % 7) * 1000;
+        audio_write(0xFF12, i ? 0xA1 : 0xF2, cycle);
+        audio_write(0xFF13, (notes[frame % 8] - 512) & 0xFF, cycle);
+        audio_write(0xFF14, 0x80 | ((notes[frame % 8] - 512) >> 8),
+                    cycle + 4);
+    }
+
+    // and wave RAM rewritten, a byte at a time, while channel 3 plays it
+    if (frame == 0)
+    {
+        audio_write(0xFF1D, 0x00, 0);
+        audio_write(0xFF1E, 0x87, 8);
+    }
+    for (uint16_t i = 0; i < 16; ++i)
+    {
+        const uint8_t v = (i + frame) % 16;
+        audio_write(0xFF30 + i, (v << 4) | (15 - v), 1000 + i * 4000);
+    }
+}
+
+static void play_mix(const uint32_t frame)
+{
+    // the third leaves channels 1 and 3 out altogether, while channel 1's
+    // envelope and sweep should carry on
+    static const uint8_t panning[4] = {0xFF, 0x5A, 0xEA, 0x3C};
+
+    play_square(frame);
+    play_wave(frame);
+    play_noise(frame);
+
+    if (frame % 16 == 0)
+        audio_write(0xFF25, panning[(frame / 16) % 4], 20000);
+    if (frame % 40 == 0)
+        audio_write(0xFF24, (frame / 40) % 2 ? 0x35 : 0x77, 40000);
+}
+
+static const struct workload
+{
+    const char *name;
+    void (*play)(uint32_t frame);
+} workloads[] = {
+    {"square", play_square},
+    {"wave", play_wave},
+    {"noise", play_noise},
+    {"arp", play_arp},
+    {"mix", play_mix},
+};
+
+static const char *const quality_names[] = {"fast", "blep"};
+static const uint32_t rates[] = {44100, 22050, 11025};
+
+struct render
+{
+    uint32_t hash;
+    uint32_t frame;
+    uint32_t samples;
+    uint32_t calls;
+    double render_time;
+    FILE *wav;
+};
+
+static double seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// sets up the APU as a game being loaded does
+static void start_apu(uint8_t *audio_mem, const enum audio_quality quality,
+                      const uint32_t rate)
+{
+    audio_set_quality(quality);
+    audio_set_sample_rate(rate);
+    audio_set_gain(AUDIO_GAIN_UNITY);
+    audio_set_paced(false);
+    audio_init(audio_mem);
+}
+
+// renders the frame just emulated, as audio_record_frame does
+static void render_frame(struct render *r)
+{
+    static int16_t left[AUDIO_RECORD_BLOCK], right[AUDIO_RECORD_BLOCK];
+    static int16_t out[AUDIO_RECORD_BLOCK * 2];
+
+    const uint32_t end = audio_record_frame_end(r->frame++);
+    while (r->samples < end)
+    {
+        const int n = PGB_MIN(AUDIO_RECORD_BLOCK, end - r->samples);
+
+        memset(left, 0, n * sizeof(left[0]));
+        memset(right, 0, n * sizeof(right[0]));
+
+        const double start = seconds();
+        audio_render(left, right, n);
+        r->render_time += seconds() - start;
+        r->calls++;
+
+        for (int i = 0; i < n; ++i)
+        {
+            out[i * 2] = left[i];
+            out[i * 2 + 1] = right[i];
+        }
+
+        r->hash = audio_record_hash(r->hash, out, n * 4);
+        if (r->wav)
+            fwrite(out, 4, n, r->wav);
+        r->samples += n;
+    }
+}
+
+static uint32_t run_workload(const struct workload *w,
+                             const enum audio_quality quality,
+                             const uint32_t rate, const uint32_t frames,
+                             double *us_per_frame, double *us_per_call)
+{
+    static uint8_t audio_mem[0x30];
+    struct render r = {.hash = AUDIO_RECORD_HASH_INIT};
+
+    start_apu(audio_mem, quality, rate);
+    audio_write(0xFF26, 0x80, 0);
+    audio_write(0xFF24, 0x77, 0);
+    audio_write(0xFF25, 0xFF, 0);
+
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+        w->play(frame);
+        audio_end_frame();
+        render_frame(&r);
+    }
+
+    *us_per_frame = r.render_time * 1e6 / frames;
+    *us_per_call = r.render_time * 1e6 / r.calls;
+    return r.hash;
+}
+
+static const struct workload *find_workload(const char *name)
+{
+    for (size_t i = 0; i < PEANUT_GB_ARRAYSIZE(workloads); ++i)
+    {
+        if (strcmp(workloads[i].name, name) == 0)
+            return &workloads[i];
+    }
+    return NULL;
+}
+
+static int check(const char *refs_path)
+{
+    FILE *refs = fopen(refs_path, "r");
+    if (!refs)
+    {
+        fprintf(stderr, "cannot open %s\n", refs_path);
+        return 2;
+    }
+
+    char line[256];
+    int checked = 0, failed = 0;
+    while (fgets(line, sizeof(line), refs))
+    {
+        char name[32], quality_name[8];
+        unsigned rate, frames, expected;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%31s %7s %u %u %x", name, quality_name, &rate,
+                   &frames, &expected) != 5)
+        {
+            fprintf(stderr, "bad reference: %s", line);
+            failed++;
+            continue;
+        }
+
+        const struct workload *w = find_workload(name);
+        const enum audio_quality quality = strcmp(quality_name, "blep") == 0
+                                               ? AUDIO_QUALITY_BLEP
+                                               : AUDIO_QUALITY_FAST;
+        if (!w)
+        {
+            fprintf(stderr, "unknown workload: %s\n", name);
+            failed++;
+            continue;
+        }
+
+        double us, us_call;
+        const uint32_t hash =
+            run_workload(w, quality, rate, frames, &us, &us_call);
+        checked++;
+        if (hash != expected)
+        {
+            failed++;
+            printf("FAIL %-6s %s %5u: %08x, expected %08x\n", name,
+                   quality_names[quality], rate, (unsigned)hash, expected);
+        }
+        else
+        {
+            printf("ok   %-6s %s %5u: %08x  %6.1f us/frame  %5.2f us/call\n",
+                   name, quality_names[quality], rate, (unsigned)hash, us,
+                   us_call);
+        }
+    }
+    fclose(refs);
+
+    printf("%d of %d fingerprints match\n", checked - failed, checked);
+    return failed ? 1 : 0;
+}
+
+static int update(const char *refs_path)
+{
+    FILE *refs = fopen(refs_path, "w");
+    if (!refs)
+    {
+        fprintf(stderr, "cannot create %s\n", refs_path);
+        return 2;
+    }
+
+    fprintf(refs,
+            "# APU output fingerprints; see tools/apu_fingerprint.c.\n"
+            "# workload quality rate frames fingerprint\n");
+    for (size_t i = 0; i < PEANUT_GB_ARRAYSIZE(workloads); ++i)
+    {
+        for (int q = AUDIO_QUALITY_FAST; q <= AUDIO_QUALITY_BLEP; ++q)
+        {
+            for (size_t j = 0; j < PEANUT_GB_ARRAYSIZE(rates); ++j)
+            {
+                double us, us_call;
+                const uint32_t hash =
+                    run_workload(&workloads[i], q, rates[j], WORKLOAD_FRAMES,
+                                 &us, &us_call);
+                fprintf(refs, "%s %s %u %u %08x\n", workloads[i].name,
+                        quality_names[q], (unsigned)rates[j],
+                        WORKLOAD_FRAMES, (unsigned)hash);
+            }
+        }
+    }
+    fclose(refs);
+    return 0;
+}
+
+static void rom_error(struct gb_s *gb, const enum gb_error_e gb_err,
+                      const uint16_t val)
+{
+    log_error("emulation error %d at %04x", gb_err, val);
+}
+
+static void write_wav_header(FILE *wav, const uint32_t samples)
+{
+    uint8_t h[44];
+    const uint32_t fields[][3] = {
+        {4, 4, 36 + samples * 4},        {16, 4, 16},
+        {20, 2, 1},                      {22, 2, 2},
+        {24, 4, AUDIO_OUTPUT_RATE},      {28, 4, AUDIO_OUTPUT_RATE * 4},
+        {32, 2, 4},                      {34, 2, 16},
+        {40, 4, samples * 4},
+    };
+
+    memcpy(h, "RIFF", 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    memcpy(h + 36, "data", 4);
+    for (size_t i = 0; i < PEANUT_GB_ARRAYSIZE(fields); ++i)
+    {
+        for (uint32_t b = 0; b < fields[i][1]; ++b)
+            h[fields[i][0] + b] = fields[i][2] >> (8 * b);
+    }
+
+    fseek(wav, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), wav);
+}
+
+// runs a ROM from power-on with no buttons pressed
+static int render_rom(const char *rom_path, const uint32_t frames,
+                      const char *wav_path)
+{
+    FILE *f = fopen(rom_path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "cannot open %s\n", rom_path);
+        return 2;
+    }
+    fseek(f, 0, SEEK_END);
+    const long rom_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *rom = malloc(rom_size);
+    if (!rom || fread(rom, 1, rom_size, f) != (size_t)rom_size)
+    {
+        fprintf(stderr, "cannot read %s\n", rom_path);
+        return 2;
+    }
+    fclose(f);
+
+    static struct gb_s gb;
+    static uint8_t wram[WRAM_SIZE], vram[VRAM_SIZE];
+    static uint8_t lcd[LCD_HEIGHT * LCD_WIDTH_PACKED * 2];
+    if (gb_init(&gb, wram, vram, lcd, rom, rom_error, NULL) !=
+        GB_INIT_NO_ERROR)
+    {
+        fprintf(stderr, "%s is not a supported ROM\n", rom_path);
+        return 2;
+    }
+    gb.gb_cart_ram_size = gb_get_save_size(&gb);
+    gb.gb_cart_ram = calloc(1, gb.gb_cart_ram_size + 1);
+    gb_init_lcd(&gb, NULL);
+
+    struct render r = {.hash = AUDIO_RECORD_HASH_INIT};
+    if (wav_path)
+    {
+        r.wav = fopen(wav_path, "wb");
+        if (!r.wav)
+        {
+            fprintf(stderr, "cannot create %s\n", wav_path);
+            return 2;
+        }
+        write_wav_header(r.wav, 0);
+    }
+
+    start_apu(gb.hram + 0x10, AUDIO_QUALITY_FAST, AUDIO_OUTPUT_RATE / 2);
+    gb.direct.sound = 1;
+    gb.direct.joypad = 0xFF;
+
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+        gb_run_frame(&gb);
+        audio_end_frame();
+        render_frame(&r);
+    }
+
+    if (r.wav)
+    {
+        write_wav_header(r.wav, r.samples);
+        fclose(r.wav);
+    }
+
+    printf("%u frames, %u samples, fingerprint %08x, %.1f us rendering per "
+           "frame\n",
+           (unsigned)frames, (unsigned)r.samples, (unsigned)r.hash,
+           r.render_time * 1e6 / frames);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "check") == 0)
+        return check(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "update") == 0)
+        return update(argv[2]);
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "rom") == 0)
+        return render_rom(argv[2], strtoul(argv[3], NULL, 0),
+                          argc == 5 ? argv[4] : NULL);
+
+    fprintf(stderr,
+            "usage: %s check REFS\n"
+            "       %s update REFS\n"
+            "       %s rom ROM FRAMES [WAV]\n",
+            argv[0], argv[0], argv[0]);
+    return 2;
+}
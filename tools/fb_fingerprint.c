@@ -0,0 +1,279 @@
+//
+//  fb_fingerprint.c
+//  CrankBoy
+//
+//  Host-side runner for the framebuffer blitters: dithers a fixed gameboy
+//  screen to the playdate framebuffer in every scale and dither mode (both
+//  phases of the temporal engine, several pans of 2x) and fingerprints the
+//  framebuffer together with the rows marked as updated. `make fb-check`
+//  compares them with the references in fb_fingerprint.ref, so that a change
+//  to the blitters or the dither tables either leaves the picture
+//  bit-identical or shows which modes it affects. Each case is drawn
+//  TIMED_FRAMES times and the time per full-screen redraw is printed beside
+//  its fingerprint. Like the simulator build, this compiles the blitters at
+//  -O0, so the figures compare modes and changes rather than predict the
+//  device.
+//
+//  usage: fb_fingerprint check REFS
+//         fb_fingerprint update REFS
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../peanut_gb/peanut_gb.h"
+#include "../src/dither.h"
+
+#define FB_SIZE (LCD_ROWS * LCD_ROWSIZE)
+#define FNV_OFFSET 0x811C9DC5u
+#define FNV_PRIME 0x01000193u
+#define TIMED_FRAMES 200
+
+static void log_line(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+static void log_error(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(2);
+}
+
+static struct playdate_sys host_system = {
+    .logToConsole = log_line,
+    .error = log_error,
+};
+static PlaydateAPI host_api = {.system = &host_system};
+PlaydateAPI *playdate = &host_api;
+
+static const char *const scale_names[PGB_ScaleModeCount] = {
+    [PGB_ScaleModeFit] = "fit",
+    [PGB_ScaleMode1x] = "1x",
+    [PGB_ScaleMode2x] = "2x",
+    [PGB_ScaleModeStretch] = "stretch",
+};
+
+static const char *const dither_names[PGB_DitherModeCount] = {
+    [PGB_DitherModePattern] = "pattern",
+    [PGB_DitherModeBayer] = "bayer",
+    [PGB_DitherModeBlueNoise] = "bluenoise",
+    [PGB_DitherModeTemporal] = "temporal",
+};
+
+// crank positions the 2x mode is checked at
+static const unsigned pans[] = {0, 7, 24};
+
+static uint8_t lcd[LCD_HEIGHT * LCD_WIDTH_PACKED] __attribute__((aligned(4)));
+static uint8_t framebuffer[FB_SIZE] __attribute__((aligned(4)));
+static uint32_t hash;
+
+static uint32_t fnv1a(uint32_t h, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+        h = (h ^ data[i]) * FNV_PRIME;
+    return h;
+}
+
+static double seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void mark_rows(int start, int end)
+{
+    const uint8_t rows[2] = {start, end};
+    hash = fnv1a(hash, rows, sizeof(rows));
+}
+
+// a gameboy screen with every shade in every column and line phase: flat
+// bands of each shade at the top, then noise
+static void make_screen(void)
+{
+    uint32_t x = 0x2545F491;
+
+    for (size_t i = 0; i < sizeof(lcd); ++i)
+    {
+        if (i < 16 * LCD_WIDTH_PACKED)
+        {
+            lcd[i] = 0x55 * (i / (4 * LCD_WIDTH_PACKED));
+            continue;
+        }
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        lcd[i] = x;
+    }
+}
+
+// draws every line of the screen TIMED_FRAMES times; the fingerprint is of
+// the last redraw
+static uint32_t run_case(const PGB_ScaleMode scale,
+                         const PGB_DitherMode dither, const unsigned pan,
+                         const unsigned phase, double *us_per_frame)
+{
+    static const uint16_t all_lines[(LCD_HEIGHT + 15) / 16] = {
+        0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+        0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+    };
+    double render_time = 0;
+
+    PGB_Dither_updateTables(dither);
+    PGB_dither_row_offset = phase ? PGB_dither_temporal_rows : 0;
+
+    for (int i = 0; i < TIMED_FRAMES; ++i)
+    {
+        PGB_RowMarker marker = {.markUpdateRows = mark_rows};
+
+        // anything the blitter doesn't draw keeps this pattern
+        memset(framebuffer, 0xA5, sizeof(framebuffer));
+        hash = FNV_OFFSET;
+
+        const double start = seconds();
+        update_fb_dirty_lines(framebuffer, lcd, all_lines, &marker, scale,
+                              pan);
+        render_time += seconds() - start;
+    }
+
+    *us_per_frame = render_time * 1e6 / TIMED_FRAMES;
+    return fnv1a(hash, framebuffer, sizeof(framebuffer));
+}
+
+static int find_name(const char *const *names, const int count,
+                     const char *name)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (strcmp(names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int check(const char *refs_path)
+{
+    FILE *refs = fopen(refs_path, "r");
+    if (!refs)
+    {
+        fprintf(stderr, "cannot open %s\n", refs_path);
+        return 2;
+    }
+
+    char line[256];
+    int checked = 0, failed = 0;
+    while (fgets(line, sizeof(line), refs))
+    {
+        char scale_name[16], dither_name[16];
+        unsigned pan, phase, expected;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%15s %15s %u %u %x", scale_name, dither_name, &pan,
+                   &phase, &expected) != 5)
+        {
+            fprintf(stderr, "bad reference: %s", line);
+            failed++;
+            continue;
+        }
+
+        const int scale =
+            find_name(scale_names, PGB_ScaleModeCount, scale_name);
+        const int dither =
+            find_name(dither_names, PGB_DitherModeCount, dither_name);
+        if (scale < 0 || dither < 0)
+        {
+            fprintf(stderr, "unknown mode: %s %s\n", scale_name, dither_name);
+            failed++;
+            continue;
+        }
+
+        double us;
+        const uint32_t got = run_case(scale, dither, pan, phase, &us);
+        checked++;
+        if (got != expected)
+        {
+            failed++;
+            printf("FAIL %-7s %-9s %2u %u: %08x, expected %08x\n", scale_name,
+                   dither_name, pan, phase, (unsigned)got, expected);
+        }
+        else
+        {
+            printf("ok   %-7s %-9s %2u %u: %08x  %7.1f us/frame\n",
+                   scale_name, dither_name, pan, phase, (unsigned)got, us);
+        }
+    }
+    fclose(refs);
+
+    printf("%d of %d fingerprints match\n", checked - failed, checked);
+    return failed ? 1 : 0;
+}
+
+static int update(const char *refs_path)
+{
+    FILE *refs = fopen(refs_path, "w");
+    if (!refs)
+    {
+        fprintf(stderr, "cannot create %s\n", refs_path);
+        return 2;
+    }
+
+    fprintf(refs,
+            "# Framebuffer fingerprints; see tools/fb_fingerprint.c.\n"
+            "# scale dither pan phase fingerprint\n");
+    for (int scale = 0; scale < PGB_ScaleModeCount; ++scale)
+    {
+        // the crank only pans in 2x
+        const size_t n_pans =
+            scale == PGB_ScaleMode2x ? PEANUT_GB_ARRAYSIZE(pans) : 1;
+
+        for (int dither = 0; dither < PGB_DitherModeCount; ++dither)
+        {
+            // only the temporal engine has an odd phase
+            PGB_Dither_updateTables(dither);
+            const unsigned phases = PGB_dither_temporal_rows ? 2 : 1;
+
+            for (size_t p = 0; p < n_pans; ++p)
+            {
+                for (unsigned phase = 0; phase < phases; ++phase)
+                {
+                    double us;
+                    const uint32_t fingerprint =
+                        run_case(scale, dither, pans[p], phase, &us);
+                    fprintf(refs, "%s %s %u %u %08x\n", scale_names[scale],
+                            dither_names[dither], pans[p], phase,
+                            (unsigned)fingerprint);
+                }
+            }
+        }
+    }
+    fclose(refs);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    make_screen();
+
+    if (argc == 3 && strcmp(argv[1], "check") == 0)
+        return check(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "update") == 0)
+        return update(argv[2]);
+
+    fprintf(stderr,
+            "usage: %s check REFS\n"
+            "       %s update REFS\n",
+            argv[0], argv[0]);
+    return 2;
+}
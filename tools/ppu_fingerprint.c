@@ -0,0 +1,253 @@
+//
+//  ppu_fingerprint.c
+//  CrankBoy
+//
+//  Host-side runner for the scanline renderer: draws a fixed VRAM, OAM and
+//  palette state under a set of LCDC configurations, through the renderer
+//  the PPU would select for each, and fingerprints the lines drawn.
+//  `make ppu-check` compares them with the references in
+//  ppu_fingerprint.ref, so that a change to the renderer either leaves the
+//  lines bit-identical or shows which configurations it affects. Each
+//  configuration is drawn TIMED_FRAMES times and the time per line is
+//  printed beside its fingerprint. Like the simulator build, this compiles
+//  the renderer at -O0, so the figures compare configurations and changes
+//  rather than predict the device.
+//
+//  usage: ppu_fingerprint check REFS
+//         ppu_fingerprint update REFS
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PGB_IMPL
+#include "../minigb_apu/minigb_apu.h"
+#include "../peanut_gb/peanut_gb.h"
+
+#define ROM_SIZE 0x8000
+#define FNV_OFFSET 0x811C9DC5u
+#define FNV_PRIME 0x01000193u
+#define TIMED_FRAMES 100
+
+static void log_line(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+static void log_error(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(2);
+}
+
+static struct playdate_sys host_system = {
+    .logToConsole = log_line,
+    .error = log_error,
+};
+static PlaydateAPI host_api = {.system = &host_system};
+PlaydateAPI *playdate = &host_api;
+
+void __gb_on_breakpoint(struct gb_s *gb, int breakpoint_number)
+{
+}
+
+// the configurations written to LCDC: each specialised renderer, plus
+// the other tile data and map areas and the generic fallback
+static const uint8_t lcdc_values[] = {
+    0x91, 0x93, 0x97, 0xB1, 0xB3, 0xB7,  // specialised
+    0x81, 0x9B, 0xF3, 0xF7,              // other areas
+    0x90, 0x92, 0xB2, 0x95,              // BG off, OBJ 8x16 bit alone
+};
+
+static struct gb_s gb;
+static uint8_t rom[ROM_SIZE];
+static uint8_t wram[WRAM_SIZE], vram[VRAM_SIZE];
+static uint8_t lcd[LCD_HEIGHT * LCD_WIDTH_PACKED];
+
+static double seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void rom_error(struct gb_s *gb, const enum gb_error_e gb_err,
+                      const uint16_t val)
+{
+    log_error("emulation error %d at %04x", gb_err, val);
+}
+
+// a ROM-only cartridge with a valid header, and VRAM and OAM filled with
+// noise through the bus, so that the tile caches are built as in a game
+static void start_gb(void)
+{
+    uint8_t checksum = 0;
+    for (uint16_t i = 0x0134; i <= 0x014C; i++)
+        checksum = checksum - rom[i] - 1;
+    rom[ROM_HEADER_CHECKSUM_LOC] = checksum;
+
+    if (gb_init(&gb, wram, vram, lcd, rom, rom_error, NULL) !=
+        GB_INIT_NO_ERROR)
+    {
+        log_error("cannot initialise the emulator");
+    }
+    gb_init_lcd(&gb, NULL);
+
+    uint32_t x = 0x2545F491;
+    for (uint16_t addr = 0x8000; addr < 0xA000; addr++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        __gb_write(&gb, addr, x);
+    }
+    for (uint16_t addr = 0xFE00; addr < 0xFEA0; addr++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        __gb_write(&gb, addr, x);
+    }
+
+    __gb_write(&gb, 0xFF42, 5);     // SCY
+    __gb_write(&gb, 0xFF43, 3);     // SCX
+    __gb_write(&gb, 0xFF4A, 60);    // WY
+    __gb_write(&gb, 0xFF4B, 47);    // WX
+    __gb_write(&gb, 0xFF47, 0xE4);  // BGP
+    __gb_write(&gb, 0xFF48, 0xD2);  // OBP0
+    __gb_write(&gb, 0xFF49, 0x1B);  // OBP1
+}
+
+// draws every line of a frame as the PPU does, and returns its fingerprint
+static uint32_t draw_frame(void)
+{
+    for (int ly = 0; ly < LCD_HEIGHT; ly++)
+    {
+        gb.gb_reg.LY = ly;
+        if (ly == 0)
+        {
+            gb.display.WY = gb.gb_reg.WY;
+            gb.display.window_clear = 0;
+        }
+        gb.display.draw_line(&gb);
+    }
+
+    uint32_t h = FNV_OFFSET;
+    for (size_t i = 0; i < sizeof(lcd); ++i)
+        h = (h ^ lcd[i]) * FNV_PRIME;
+    return h;
+}
+
+static uint32_t run_case(const uint8_t lcdc, double *ns_per_line)
+{
+    uint32_t fingerprint = 0;
+    double draw_time = 0;
+
+    __gb_write(&gb, 0xFF40, lcdc);
+    draw_frame();  // builds the sprite tables outside the timing
+
+    for (int i = 0; i < TIMED_FRAMES; ++i)
+    {
+        memset(lcd, 0xA5, sizeof(lcd));
+
+        const double start = seconds();
+        fingerprint = draw_frame();
+        draw_time += seconds() - start;
+    }
+
+    *ns_per_line = draw_time * 1e9 / (TIMED_FRAMES * LCD_HEIGHT);
+    return fingerprint;
+}
+
+static int check(const char *refs_path)
+{
+    FILE *refs = fopen(refs_path, "r");
+    if (!refs)
+    {
+        fprintf(stderr, "cannot open %s\n", refs_path);
+        return 2;
+    }
+
+    char line[256];
+    int checked = 0, failed = 0;
+    while (fgets(line, sizeof(line), refs))
+    {
+        unsigned lcdc, expected;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%x %x", &lcdc, &expected) != 2 || lcdc > 0xFF)
+        {
+            fprintf(stderr, "bad reference: %s", line);
+            failed++;
+            continue;
+        }
+
+        double ns;
+        const uint32_t got = run_case(lcdc, &ns);
+        checked++;
+        if (got != expected)
+        {
+            failed++;
+            printf("FAIL %02x: %08x, expected %08x\n", lcdc, (unsigned)got,
+                   expected);
+        }
+        else
+        {
+            printf("ok   %02x: %08x  %6.0f ns/line\n", lcdc, (unsigned)got,
+                   ns);
+        }
+    }
+    fclose(refs);
+
+    printf("%d of %d fingerprints match\n", checked - failed, checked);
+    return failed ? 1 : 0;
+}
+
+static int update(const char *refs_path)
+{
+    FILE *refs = fopen(refs_path, "w");
+    if (!refs)
+    {
+        fprintf(stderr, "cannot create %s\n", refs_path);
+        return 2;
+    }
+
+    fprintf(refs,
+            "# Scanline renderer fingerprints; see tools/ppu_fingerprint.c.\n"
+            "# lcdc fingerprint\n");
+    for (size_t i = 0; i < PEANUT_GB_ARRAYSIZE(lcdc_values); ++i)
+    {
+        double ns;
+        const uint32_t fingerprint = run_case(lcdc_values[i], &ns);
+        fprintf(refs, "%02x %08x\n", lcdc_values[i], (unsigned)fingerprint);
+    }
+    fclose(refs);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    start_gb();
+
+    if (argc == 3 && strcmp(argv[1], "check") == 0)
+        return check(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "update") == 0)
+        return update(argv[2]);
+
+    fprintf(stderr,
+            "usage: %s check REFS\n"
+            "       %s update REFS\n",
+            argv[0], argv[0]);
+    return 2;
+}